@@ -0,0 +1,232 @@
+/*
+  Scaling benchmark: runs N channels at once through the same sources,
+  forwarding, sound_sink and visualization as the babysitter, fed from
+  a capture in real time instead of an NVR. Every channel triggers
+  while it runs. For each N, one JSON object is printed on its own line:
+
+  {"channels":4,"seconds":10,"cpu_percent":..,"cpu_percent_per_channel":..
+  ,"rss_kb":..,"peak_rss_kb":..,"threads":..
+  ,"trigger_to_audio_ms":{"count":..,"min":..,"median":..,"max":..}
+  ,"trigger_to_first_frame_ms":{...}}
+
+  Without --capture, a synthetic one is written first: a quiet tone
+  that gets loud for two seconds, with raw I420 frames alongside.
+ */
+#include <rtvc/babysitter.hpp>
+#include <rtvc/capture/format.hpp>
+
+#include <gst/gst.h>
+
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+// seconds of a mono S16 tone at 8 kHz in 20 ms buffers, loud between
+// 2 and 4 seconds, and a 176x144 gray frame every 100 ms
+static void write_synthetic (std::string const& path, unsigned int seconds)
+{
+  rtvc::capture::writer writer (path);
+  GstCaps* audio_caps = gst_caps_from_string ("audio/x-raw,format=S16LE,layout=interleaved,rate=8000,channels=1");
+  GstCaps* video_caps = gst_caps_from_string ("video/x-raw,format=I420,width=176,height=144,framerate=10/1");
+  const unsigned int rate = 8000, samples = rate / 50;
+  const std::size_t frame_size = 176 * 144 * 3 / 2;
+  std::vector<std::int16_t> audio (samples);
+  std::vector<std::uint8_t> video (frame_size);
+
+  for (unsigned int i = 0; i != seconds * 50; ++i)
+  {
+    GstClockTime pts = i * 20 * GST_MSECOND;
+    if (i % 5 == 0)
+    {
+      std::fill (video.begin (), video.begin () + 176 * 144, static_cast<std::uint8_t> (i));
+      std::fill (video.begin () + 176 * 144, video.end (), 128);
+      GstBuffer* buffer = gst_buffer_new_allocate (nullptr, video.size (), nullptr);
+      gst_buffer_fill (buffer, 0, video.data (), video.size ());
+      GST_BUFFER_PTS (buffer) = GST_BUFFER_DTS (buffer) = pts;
+      GST_BUFFER_DURATION (buffer) = 100 * GST_MSECOND;
+      writer.write (rtvc::capture::stream::video, video_caps, buffer);
+      gst_buffer_unref (buffer);
+    }
+
+    double amplitude = pts >= 2 * GST_SECOND && pts < 4 * GST_SECOND ? 16000. : 100.;
+    for (unsigned int s = 0; s != samples; ++s)
+      audio[s] = amplitude * std::sin (2 * M_PI * 440. * (i * samples + s) / rate);
+    GstBuffer* buffer = gst_buffer_new_allocate (nullptr, audio.size () * sizeof(std::int16_t), nullptr);
+    gst_buffer_fill (buffer, 0, audio.data (), audio.size () * sizeof(std::int16_t));
+    GST_BUFFER_PTS (buffer) = GST_BUFFER_DTS (buffer) = pts;
+    GST_BUFFER_DURATION (buffer) = 20 * GST_MSECOND;
+    writer.write (rtvc::capture::stream::audio, audio_caps, buffer);
+    gst_buffer_unref (buffer);
+  }
+  gst_caps_unref (audio_caps);
+  gst_caps_unref (video_caps);
+}
+
+// Field of /proc/self/status, in its own unit, 0 if missing
+static long status_field (std::string const& name)
+{
+  std::ifstream status ("/proc/self/status");
+  std::string line;
+  while (std::getline (status, line))
+    if (line.compare (0, name.size () + 1, name + ":") == 0)
+      return std::atol (line.c_str () + name.size () + 1);
+  return 0;
+}
+
+static double cpu_seconds ()
+{
+  rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+    + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// count, min, median and max of microsecond samples, in milliseconds
+static std::string summary (std::vector<gint64> values)
+{
+  std::ostringstream out;
+  out << "{\"count\":" << values.size ();
+  if (!values.empty ())
+  {
+    std::sort (values.begin (), values.end ());
+    out << ",\"min\":" << values.front () / 1000.
+        << ",\"median\":" << values[values.size () / 2] / 1000.
+        << ",\"max\":" << values.back () / 1000.;
+  }
+  out << "}";
+  return out.str ();
+}
+
+static gboolean quit_cb (gpointer data)
+{
+  g_main_loop_quit (static_cast<GMainLoop*>(data));
+  return G_SOURCE_REMOVE;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  std::vector<unsigned int> counts {1, 4, 16, 64};
+  std::string capture;
+  unsigned int seconds = 10;
+  bool verbose = false;
+  rtvc::babysitter::settings config;
+  config.audio_sink = "fakesink";
+  config.video_sink = "fakesink";
+
+  {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help", "produce help message")
+      ("channels", po::value<std::vector<unsigned int>>()->multitoken(), "Channel counts to run, 1 4 16 64 by default")
+      ("capture", po::value<std::string>(), "Capture every channel replays, a synthetic one by default")
+      ("seconds", po::value<unsigned int>(), "How long each count runs, 10 by default")
+      ("width", po::value<unsigned int>(), "Width of the mosaic")
+      ("height", po::value<unsigned int>(), "Height of the mosaic")
+      ("verbose", "Keep the babysitter log on stdout")
+      ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+      std::cout << desc << "\n";
+      return 1;
+    }
+
+    if (vm.count("channels")) counts = vm["channels"].as<std::vector<unsigned int>>();
+    if (vm.count("capture")) capture = vm["capture"].as<std::string>();
+    if (vm.count("seconds")) seconds = vm["seconds"].as<unsigned int>();
+    if (vm.count("width")) config.width = vm["width"].as<unsigned int>();
+    if (vm.count("height")) config.height = vm["height"].as<unsigned int>();
+    if (vm.count("verbose")) verbose = true;
+  }
+
+  gst_init (&argc, &argv);
+
+  bool synthetic = capture.empty ();
+  if (synthetic)
+  {
+    capture = std::string (g_get_tmp_dir ()) + "/rtvc-bench-" + std::to_string (getpid ()) + ".rtvc";
+    write_synthetic (capture, seconds);
+  }
+
+  // Results are the only thing on stdout
+  std::ostream results (std::cout.rdbuf ());
+  std::ofstream null ("/dev/null");
+  if (!verbose)
+    std::cout.rdbuf (null.rdbuf ());
+
+  GMainLoop* main_loop = g_main_loop_new (NULL, FALSE);
+  for (unsigned int count : counts)
+  {
+    std::unique_ptr<rtvc::babysitter> babysitter (new rtvc::babysitter (config));
+    // Fakesinks still play at the pace of the clock, like real ones
+    g_object_set (G_OBJECT (babysitter->sound_sink.sink), "sync", TRUE, NULL);
+    g_object_set (G_OBJECT (babysitter->visualization.sink), "sync", TRUE, NULL);
+
+    gint64 start = g_get_monotonic_time ();
+    double cpu_start = cpu_seconds ();
+    rtvc::channel_settings replay;
+    replay.replay = true;
+    for (unsigned int i = 0; i != count; ++i)
+      babysitter->add_channel (capture, 0, i, replay);
+    g_timeout_add_seconds (seconds, &quit_cb, main_loop);
+    g_main_loop_run (main_loop);
+    double cpu = cpu_seconds () - cpu_start;
+    double wall = (g_get_monotonic_time () - start) / 1e6;
+    long rss = status_field ("VmRSS"), peak_rss = status_field ("VmHWM"), threads = status_field ("Threads");
+
+    std::vector<gint64> to_audio, to_frame;
+    for (auto&& c : babysitter->channels)
+      if (c.second->trigger_to_audio >= 0)
+        to_audio.push_back (c.second->trigger_to_audio);
+    {
+      std::lock_guard<std::mutex> lock (babysitter->visualization.mutex);
+      for (auto&& tile : babysitter->visualization.tiles)
+        if (tile->first_frame >= 0)
+          to_frame.push_back (tile->first_frame);
+    }
+
+    while (!babysitter->channels.empty ())
+    {
+      rtvc::babysitter::channel_key key = babysitter->channels.begin ()->first;
+      babysitter->remove_channel (std::get<0> (key), std::get<1> (key), std::get<2> (key));
+    }
+    babysitter.reset ();
+    // Sources left for the main loop to destroy
+    while (g_main_context_iteration (NULL, FALSE))
+      ;
+
+    results << "{\"channels\":" << count
+            << ",\"seconds\":" << wall
+            << ",\"cpu_percent\":" << 100. * cpu / wall
+            << ",\"cpu_percent_per_channel\":" << 100. * cpu / wall / count
+            << ",\"rss_kb\":" << rss
+            << ",\"peak_rss_kb\":" << peak_rss
+            << ",\"threads\":" << threads
+            << ",\"trigger_to_audio_ms\":" << summary (to_audio)
+            << ",\"trigger_to_first_frame_ms\":" << summary (to_frame)
+            << "}" << std::endl;
+  }
+  g_main_loop_unref (main_loop);
+
+  std::cout.rdbuf (results.rdbuf ());
+  if (synthetic)
+    unlink (capture.c_str ());
+  return 0;
+}
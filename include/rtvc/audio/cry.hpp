@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_AUDIO_CRY_HPP
+#define RTVC_AUDIO_CRY_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <deque>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace rtvc { namespace audio {
+
+// In place radix 2 FFT of a power of two size, twiddles computed once
+struct fft
+{
+  std::size_t size;
+  std::vector<std::complex<float>> twiddles;
+  std::vector<std::size_t> reversed;
+
+  fft (std::size_t size)
+    : size (size), twiddles (size / 2), reversed (size)
+  {
+    for (std::size_t i = 0; i != size / 2; ++i)
+      twiddles[i] = std::polar (1.f, static_cast<float> (-2. * M_PI * i / size));
+    unsigned int bits = 0;
+    while ((std::size_t (1) << bits) < size)
+      ++bits;
+    for (std::size_t i = 0; i != size; ++i)
+    {
+      std::size_t r = 0;
+      for (unsigned int b = 0; b != bits; ++b)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      reversed[i] = r;
+    }
+  }
+
+  void operator() (std::complex<float>* data) const
+  {
+    for (std::size_t i = 0; i != size; ++i)
+      if (i < reversed[i])
+        std::swap (data[i], data[reversed[i]]);
+    for (std::size_t half = 1; half < size; half *= 2)
+    {
+      std::size_t step = size / (half * 2);
+      for (std::size_t start = 0; start != size; start += half * 2)
+        for (std::size_t k = 0; k != half; ++k)
+        {
+          std::complex<float> t = twiddles[k * step] * data[start + k + half];
+          data[start + k + half] = data[start + k] - t;
+          data[start + k] += t;
+        }
+    }
+  }
+};
+
+// out[i] = |data[i]|^2, data being interleaved real and imaginary parts
+inline void power (std::complex<float> const* data, float* out, std::size_t n)
+{
+  float const* p = reinterpret_cast<float const*>(data);
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128 a = _mm_loadu_ps (p + 2 * i), b = _mm_loadu_ps (p + 2 * i + 4);
+    __m128 re = _mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0));
+    __m128 im = _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1));
+    _mm_storeu_ps (out + i, _mm_add_ps (_mm_mul_ps (re, re), _mm_mul_ps (im, im)));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 4 <= n; i += 4)
+  {
+    float32x4x2_t v = vld2q_f32 (p + 2 * i);
+    vst1q_f32 (out + i, vmlaq_f32 (vmulq_f32 (v.val[0], v.val[0]), v.val[1], v.val[1]));
+  }
+#endif
+  for (; i != n; ++i)
+    out[i] = p[2 * i] * p[2 * i] + p[2 * i + 1] * p[2 * i + 1];
+}
+
+// Sum of values[begin, end)
+inline float sum (float const* values, std::size_t begin, std::size_t end)
+{
+  std::size_t i = begin;
+  float total = 0.f;
+#if defined(__SSE2__)
+  __m128 vtotal = _mm_setzero_ps ();
+  for (; i + 4 <= end; i += 4)
+    vtotal = _mm_add_ps (vtotal, _mm_loadu_ps (values + i));
+  alignas(16) float t[4];
+  _mm_store_ps (t, vtotal);
+  total = t[0] + t[1] + t[2] + t[3];
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t vtotal = vdupq_n_f32 (0.f);
+  for (; i + 4 <= end; i += 4)
+    vtotal = vaddq_f32 (vtotal, vld1q_f32 (values + i));
+  float t[4];
+  vst1q_f32 (t, vtotal);
+  total = t[0] + t[1] + t[2] + t[3];
+#endif
+  for (; i < end; ++i)
+    total += values[i];
+  return total;
+}
+
+// Tells infant cry from other loud sounds by its spectrum. Every frame
+// of about 64 ms, half overlapping, is cry like when it is voiced, with
+// a fundamental between 250 and 750 Hz where infants cry and above
+// where adults speak, and most of its energy between 250 and 3000 Hz.
+// Slams and fans are not voiced, TV speech is pitched too low. The
+// score is the share of cry like frames in the last 0.8 s, which
+// leaves room for the breaths between cries. A cry starting after
+// quiet is an onset as soon as its first 0.1 s are all cry like, so it
+// is told before it fills the share.
+struct cry_classifier
+{
+  unsigned int rate;
+  std::size_t frame, hop;
+  audio::fft transform;
+  std::vector<float> window;
+  std::vector<float> pending;
+  std::vector<std::complex<float>> buffer;
+  std::vector<float> spectrum;
+  std::deque<bool> history;
+  std::size_t history_size;
+  std::size_t cry_frames;
+  // Cry like frames in a row, up to the last one
+  std::size_t run;
+  std::size_t onset_frames;
+
+  cry_classifier (unsigned int rate)
+    : rate (rate), frame (frame_size (rate)), hop (frame / 2)
+    // Twice the frame, so the autocorrelation doesn't wrap around
+    , transform (frame * 2)
+    , window (frame), buffer (frame * 2), spectrum (frame * 2)
+    , history_size (std::max<std::size_t> (1, static_cast<std::size_t> (0.8 * rate / hop)))
+    , cry_frames (0), run (0)
+    , onset_frames (std::max<std::size_t> (2, static_cast<std::size_t> (0.1 * rate / hop)))
+  {
+    for (std::size_t i = 0; i != frame; ++i)
+      window[i] = 0.5f - 0.5f * std::cos (2. * M_PI * i / (frame - 1));
+  }
+
+  // First channel of interleaved samples
+  void add_s16 (std::int16_t const* samples, std::size_t frames, unsigned int channels)
+  {
+    for (std::size_t i = 0; i != frames; ++i)
+      push (samples[i * channels] * (1.f / 32768.f));
+  }
+  void add_f32 (float const* samples, std::size_t frames, unsigned int channels)
+  {
+    for (std::size_t i = 0; i != frames; ++i)
+      push (samples[i * channels]);
+  }
+
+  // 0 to 1
+  double score () const
+  {
+    return static_cast<double> (cry_frames) / history_size;
+  }
+
+  bool onset () const
+  {
+    return run >= onset_frames;
+  }
+
+private:
+  static std::size_t frame_size (unsigned int rate)
+  {
+    std::size_t size = 256;
+    while (size < rate * 64 / 1000)
+      size *= 2;
+    return size;
+  }
+
+  void push (float sample)
+  {
+    pending.push_back (sample);
+    if (pending.size () < frame)
+      return;
+    bool cry = analyze ();
+    pending.erase (pending.begin (), pending.begin () + hop);
+
+    history.push_back (cry);
+    cry_frames += cry;
+    run = cry ? run + 1 : 0;
+    if (history.size () > history_size)
+    {
+      cry_frames -= history.front ();
+      history.pop_front ();
+    }
+  }
+
+  bool analyze ()
+  {
+    std::size_t const n = frame * 2;
+    for (std::size_t i = 0; i != frame; ++i)
+      buffer[i] = pending[i] * window[i];
+    std::fill (buffer.begin () + frame, buffer.end (), std::complex<float> ());
+    transform (buffer.data ());
+    power (buffer.data (), spectrum.data (), n);
+
+    // Bins of the one sided spectrum, without DC
+    auto bin = [&] (double hz) { return std::min<std::size_t> (n / 2, static_cast<std::size_t> (hz * n / rate)); };
+    float total = sum (spectrum.data (), 1, n / 2);
+    // Quieter than about -50 dBFS is nothing to classify
+    if (total < frame * 1e-5f * frame / 4)
+      return false;
+    if (sum (spectrum.data (), bin (250.), bin (3000.)) < 0.7f * total)
+      return false;
+
+    // Autocorrelation is the inverse transform of the power spectrum,
+    // which is real and even, so a forward transform does
+    for (std::size_t i = 0; i != n; ++i)
+      buffer[i] = spectrum[i];
+    transform (buffer.data ());
+    float zero = buffer[0].real ();
+    if (zero <= 0.f)
+      return false;
+    std::size_t shortest = rate / 750, longest = rate / 250;
+    float best = 0.f;
+    for (std::size_t lag = std::max<std::size_t> (shortest, 1); lag <= longest && lag < frame; ++lag)
+      // Corrected for the overlap shrinking with the lag
+      best = std::max (best, buffer[lag].real () / zero * frame / (frame - lag));
+    return best > 0.5f;
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,177 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_AUDIO_G711_HPP
+#define RTVC_AUDIO_G711_HPP
+
+#include <rtvc/audio/level.hpp>
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace rtvc { namespace audio { namespace g711 {
+
+// A-law and mu-law bytes to linear samples, as in ITU-T G.711
+struct table
+{
+  std::int16_t linear[256];
+
+  static table const& alaw ()
+  {
+    static const table t (true);
+    return t;
+  }
+  static table const& mulaw ()
+  {
+    static const table t (false);
+    return t;
+  }
+
+  // A-law or mu-law caps, else null
+  static table const* from_caps (GstCaps* caps)
+  {
+    if (!caps || gst_caps_is_empty (caps))
+      return nullptr;
+    GstStructure const* s = gst_caps_get_structure (caps, 0);
+    if (gst_structure_has_name (s, "audio/x-alaw"))
+      return &alaw ();
+    if (gst_structure_has_name (s, "audio/x-mulaw"))
+      return &mulaw ();
+    return nullptr;
+  }
+
+  void decode (std::uint8_t const* bytes, std::int16_t* samples, std::size_t n) const
+  {
+    for (std::size_t i = 0; i != n; ++i)
+      samples[i] = linear[bytes[i]];
+  }
+
+private:
+  table (bool a)
+  {
+    for (unsigned int i = 0; i != 256; ++i)
+    {
+      if (a)
+      {
+        unsigned int v = i ^ 0x55;
+        int exponent = (v & 0x70) >> 4;
+        int value = ((v & 0x0f) << 4) + 8;
+        if (exponent)
+          value = (value + 0x100) << (exponent - 1);
+        linear[i] = (v & 0x80) ? value : -value;
+      }
+      else
+      {
+        unsigned int v = ~i & 0xff;
+        int exponent = (v & 0x70) >> 4;
+        int value = ((((v & 0x0f) << 3) + 0x84) << exponent) - 0x84;
+        linear[i] = (v & 0x80) ? -value : value;
+      }
+    }
+  }
+};
+
+// Level straight from the encoded bytes: each is looked up in the
+// table and the samples go through the same SIMD accumulation as
+// decoded audio, a block at a time, so nothing is decoded into a
+// buffer of its own
+inline audio::level level (table const& t, std::uint8_t const* bytes, std::size_t n)
+{
+  audio::level_accumulator accumulator;
+  std::int16_t block[256];
+  while (n)
+  {
+    std::size_t count = n < 256 ? n : 256;
+    t.decode (bytes, block, count);
+    accumulator.add_s16 (block, count);
+    bytes += count;
+    n -= count;
+  }
+  return accumulator.level ();
+}
+
+// Turns G.711 samples into S16 ones with the same rate and channels,
+// for the few that are actually played. Other samples are passed on.
+struct decoder
+{
+  GstCaps* input;
+  GstCaps* output;
+
+  decoder () : input (nullptr), output (nullptr) {}
+  ~decoder ()
+  {
+    if (input)
+      gst_caps_unref (input);
+    if (output)
+      gst_caps_unref (output);
+  }
+
+  decoder (decoder const&) = delete;
+  decoder& operator=(decoder const&) = delete;
+
+  // Bytes the sample has once decoded
+  static gsize size (GstSample* sample)
+  {
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    if (!buffer)
+      return 0;
+    gsize bytes = gst_buffer_get_size (buffer);
+    return table::from_caps (gst_sample_get_caps (sample)) ? bytes * sizeof(std::int16_t) : bytes;
+  }
+
+  // A new reference, to a decoded sample or to sample itself
+  GstSample* operator() (GstSample* sample)
+  {
+    GstCaps* caps = gst_sample_get_caps (sample);
+    table const* t = table::from_caps (caps);
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    if (!t || !buffer)
+      return gst_sample_ref (sample);
+
+    if (caps != input)
+    {
+      gint rate = 8000, channels = 1;
+      GstStructure const* s = gst_caps_get_structure (caps, 0);
+      gst_structure_get_int (s, "rate", &rate);
+      gst_structure_get_int (s, "channels", &channels);
+      if (input)
+        gst_caps_unref (input);
+      if (output)
+        gst_caps_unref (output);
+      input = gst_caps_ref (caps);
+      output = gst_caps_new_simple ("audio/x-raw", "format", G_TYPE_STRING, GST_AUDIO_NE (S16)
+                                    , "layout", G_TYPE_STRING, "interleaved"
+                                    , "rate", G_TYPE_INT, rate, "channels", G_TYPE_INT, channels, NULL);
+    }
+
+    GstMapInfo map;
+    if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+      return gst_sample_ref (sample);
+    GstBuffer* decoded = gst_buffer_new_allocate (nullptr, map.size * sizeof(std::int16_t), nullptr);
+    GstMapInfo out;
+    gst_buffer_map (decoded, &out, GST_MAP_WRITE);
+    t->decode (map.data, reinterpret_cast<std::int16_t*>(out.data), map.size);
+    gst_buffer_unmap (decoded, &out);
+    gst_buffer_unmap (buffer, &map);
+    // Timestamps, which its ingress time is found by, flags and metas
+    gst_buffer_copy_into (decoded, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+
+    GstSample* result = gst_sample_new (decoded, output, gst_sample_get_segment (sample), nullptr);
+    gst_buffer_unref (decoded);
+    return result;
+  }
+};
+
+} } }
+
+#endif
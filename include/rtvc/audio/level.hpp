@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_AUDIO_LEVEL_HPP
+#define RTVC_AUDIO_LEVEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace rtvc { namespace audio {
+
+// Loudness of one buffer, in dBFS. Silence is -infinity.
+struct level
+{
+  double rms;
+  double peak;
+
+  level () : rms (-std::numeric_limits<double>::infinity())
+           , peak (-std::numeric_limits<double>::infinity()) {}
+  level (double rms, double peak) : rms (rms), peak (peak) {}
+};
+
+// Accumulates sum of squares and peak of normalized samples, so
+// several runs (or several channels) can be folded into one level.
+struct level_accumulator
+{
+  double sum_squares;
+  double peak;
+  std::size_t count;
+
+  level_accumulator () : sum_squares (0.), peak (0.), count (0) {}
+
+  void add_s16 (std::int16_t const* samples, std::size_t n)
+  {
+    std::size_t i = 0;
+    std::uint64_t squares = 0;
+    int max = 0, min = 0;
+#if defined(__SSE2__)
+    __m128i vsquares = _mm_setzero_si128 ();
+    __m128i vmax = _mm_setzero_si128 ();
+    __m128i vmin = _mm_setzero_si128 ();
+    __m128i const zero = _mm_setzero_si128 ();
+    for (; i + 8 <= n; i += 8)
+    {
+      __m128i v = _mm_loadu_si128 (reinterpret_cast<__m128i const*>(samples + i));
+      vmax = _mm_max_epi16 (vmax, v);
+      vmin = _mm_min_epi16 (vmin, v);
+      // each pair sum is at most 2^31, so it fits an unsigned 32 bit lane
+      __m128i pairs = _mm_madd_epi16 (v, v);
+      vsquares = _mm_add_epi64 (vsquares, _mm_unpacklo_epi32 (pairs, zero));
+      vsquares = _mm_add_epi64 (vsquares, _mm_unpackhi_epi32 (pairs, zero));
+    }
+    {
+      alignas(16) std::uint64_t s[2];
+      alignas(16) std::int16_t mx[8], mn[8];
+      _mm_store_si128 (reinterpret_cast<__m128i*>(s), vsquares);
+      _mm_store_si128 (reinterpret_cast<__m128i*>(mx), vmax);
+      _mm_store_si128 (reinterpret_cast<__m128i*>(mn), vmin);
+      squares = s[0] + s[1];
+      max = *std::max_element (mx, mx + 8);
+      min = *std::min_element (mn, mn + 8);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint64x2_t vsquares = vdupq_n_u64 (0);
+    int16x8_t vmax = vdupq_n_s16 (0);
+    int16x8_t vmin = vdupq_n_s16 (0);
+    for (; i + 8 <= n; i += 8)
+    {
+      int16x8_t v = vld1q_s16 (samples + i);
+      vmax = vmaxq_s16 (vmax, v);
+      vmin = vminq_s16 (vmin, v);
+      int16x4_t lo = vget_low_s16 (v), hi = vget_high_s16 (v);
+      vsquares = vpadalq_u32 (vsquares, vreinterpretq_u32_s32 (vmull_s16 (lo, lo)));
+      vsquares = vpadalq_u32 (vsquares, vreinterpretq_u32_s32 (vmull_s16 (hi, hi)));
+    }
+    {
+      std::uint64_t s[2];
+      std::int16_t mx[8], mn[8];
+      vst1q_u64 (s, vsquares);
+      vst1q_s16 (mx, vmax);
+      vst1q_s16 (mn, vmin);
+      squares = s[0] + s[1];
+      max = *std::max_element (mx, mx + 8);
+      min = *std::min_element (mn, mn + 8);
+    }
+#endif
+    for (; i != n; ++i)
+    {
+      int v = samples[i];
+      squares += static_cast<std::uint64_t>(v * v);
+      max = std::max (max, v);
+      min = std::min (min, v);
+    }
+
+    double const scale = 1. / 32768.;
+    sum_squares += static_cast<double>(squares) * scale * scale;
+    peak = std::max (peak, std::max (max, -min) * scale);
+    count += n;
+  }
+
+  void add_f32 (float const* samples, std::size_t n)
+  {
+    std::size_t i = 0;
+    double squares = 0.;
+    float max = 0.f;
+#if defined(__SSE2__)
+    __m128 vsquares = _mm_setzero_ps ();
+    __m128 vmax = _mm_setzero_ps ();
+    __m128 const abs_mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    for (; i + 4 <= n; i += 4)
+    {
+      __m128 v = _mm_loadu_ps (samples + i);
+      vsquares = _mm_add_ps (vsquares, _mm_mul_ps (v, v));
+      vmax = _mm_max_ps (vmax, _mm_and_ps (v, abs_mask));
+    }
+    {
+      alignas(16) float s[4], mx[4];
+      _mm_store_ps (s, vsquares);
+      _mm_store_ps (mx, vmax);
+      squares = static_cast<double>(s[0]) + s[1] + s[2] + s[3];
+      max = *std::max_element (mx, mx + 4);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t vsquares = vdupq_n_f32 (0.f);
+    float32x4_t vmax = vdupq_n_f32 (0.f);
+    for (; i + 4 <= n; i += 4)
+    {
+      float32x4_t v = vld1q_f32 (samples + i);
+      vsquares = vmlaq_f32 (vsquares, v, v);
+      vmax = vmaxq_f32 (vmax, vabsq_f32 (v));
+    }
+    {
+      float s[4], mx[4];
+      vst1q_f32 (s, vsquares);
+      vst1q_f32 (mx, vmax);
+      squares = static_cast<double>(s[0]) + s[1] + s[2] + s[3];
+      max = *std::max_element (mx, mx + 4);
+    }
+#endif
+    for (; i != n; ++i)
+    {
+      squares += static_cast<double>(samples[i]) * samples[i];
+      max = std::max (max, std::abs (samples[i]));
+    }
+
+    sum_squares += squares;
+    peak = std::max (peak, static_cast<double>(max));
+    count += n;
+  }
+
+  audio::level level () const
+  {
+    if (!count)
+      return audio::level{};
+    return audio::level{10. * std::log10 (sum_squares / count), 20. * std::log10 (peak)};
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,194 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_AUDIO_MIX_HPP
+#define RTVC_AUDIO_MIX_HPP
+
+#include <rtvc/audio/level.hpp>
+
+#include <gst/audio/audio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace rtvc { namespace audio {
+
+// What sources deliver: mono S16 at the rate of their stream, which
+// G.711 decodes to directly. The mix is mono F32, at the highest rate
+// of its inputs, so it never saturates before the limiter and G.711
+// is only mixed at its own rate while no input has more.
+#define RTVC_AUDIO_INPUT_CAPS "audio/x-raw, format=(string)" GST_AUDIO_NE (S16) ", layout=(string)interleaved" \
+  ", channels=(int)1"
+constexpr unsigned int g711_rate = 8000;
+
+inline GstCaps* mix_caps (unsigned int rate)
+{
+  return gst_caps_new_simple ("audio/x-raw", "format", G_TYPE_STRING, GST_AUDIO_NE (F32)
+                              , "layout", G_TYPE_STRING, "interleaved"
+                              , "rate", G_TYPE_INT, static_cast<gint> (rate), "channels", G_TYPE_INT, 1, NULL);
+}
+
+// Multiplies samples by a gain going linearly from one value to
+// another over the run, saturating
+inline void ramp_s16 (std::int16_t* samples, std::size_t n, float from, float to)
+{
+  if (!n)
+    return;
+  float const step = (to - from) / n;
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  __m128 vgain = _mm_setr_ps (from, from + step, from + 2 * step, from + 3 * step);
+  __m128 const vstep = _mm_set1_ps (4 * step);
+  for (; i + 8 <= n; i += 8)
+  {
+    __m128i v = _mm_loadu_si128 (reinterpret_cast<__m128i const*>(samples + i));
+    __m128 lo = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16));
+    __m128 hi = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16));
+    lo = _mm_mul_ps (lo, vgain);
+    vgain = _mm_add_ps (vgain, vstep);
+    hi = _mm_mul_ps (hi, vgain);
+    vgain = _mm_add_ps (vgain, vstep);
+    _mm_storeu_si128 (reinterpret_cast<__m128i*>(samples + i)
+                      , _mm_packs_epi32 (_mm_cvtps_epi32 (lo), _mm_cvtps_epi32 (hi)));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float const start[4] = {from, from + step, from + 2 * step, from + 3 * step};
+  float32x4_t vgain = vld1q_f32 (start);
+  float32x4_t const vstep = vdupq_n_f32 (4 * step);
+  for (; i + 8 <= n; i += 8)
+  {
+    int16x8_t v = vld1q_s16 (samples + i);
+    float32x4_t lo = vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v)));
+    float32x4_t hi = vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v)));
+    lo = vmulq_f32 (lo, vgain);
+    vgain = vaddq_f32 (vgain, vstep);
+    hi = vmulq_f32 (hi, vgain);
+    vgain = vaddq_f32 (vgain, vstep);
+    vst1q_s16 (samples + i, vcombine_s16 (vqmovn_s32 (vcvtq_s32_f32 (lo)), vqmovn_s32 (vcvtq_s32_f32 (hi))));
+  }
+#endif
+  for (; i != n; ++i)
+  {
+    float v = samples[i] * (from + step * i);
+    samples[i] = static_cast<std::int16_t> (std::max (-32768.f, std::min (32767.f, v)));
+  }
+}
+
+// Same on a float mix, which has nothing to saturate
+inline void ramp_f32 (float* samples, std::size_t n, float from, float to)
+{
+  if (!n)
+    return;
+  float const step = (to - from) / n;
+  for (std::size_t i = 0; i != n; ++i)
+    samples[i] *= from + step * i;
+}
+
+// Keeps the float mix under threshold, before it is converted for the
+// sink. The gain drops at once to what the loudest sample of a buffer
+// needs and recovers at release dB per second, ramped within each
+// buffer.
+struct limiter
+{
+  float threshold;
+  float release;
+  float gain;
+
+  limiter (float threshold_db = -1.f, float release_db = 20.f)
+    : threshold (std::pow (10.f, threshold_db / 20.f)), release (release_db), gain (1.f)
+  {}
+
+  void process (float* samples, std::size_t n, unsigned int rate)
+  {
+    if (!n)
+      return;
+    float peak = 0.f;
+    for (std::size_t i = 0; i != n; ++i)
+      peak = std::max (peak, std::abs (samples[i]));
+    float target = peak > threshold ? threshold / peak : 1.f;
+    float recovered = gain * std::pow (10.f, release * n / rate / 20.f);
+    float next = std::min (target, std::min (1.f, recovered));
+    if (next != 1.f || gain != 1.f)
+      ramp_f32 (samples, n, std::min (gain, next), next);
+    gain = next;
+  }
+};
+
+// Gains of the inputs of a mix. Inputs heard recently are active;
+// while any is, the ones of a lower priority are ducked by lower, and
+// those of the top priority that are much quieter than the loudest by
+// quieter, so one room doesn't mask another.
+struct ducking
+{
+  struct input
+  {
+    int priority;
+    gint64 last_active;
+    double level;
+    float gain;
+
+    input () : priority (0), last_active (0), level (-std::numeric_limits<double>::infinity()), gain (1.f) {}
+  };
+
+  std::vector<input> inputs;
+  gint64 hold;
+  float lower, quieter;
+  double margin;
+
+  ducking () : hold (500000), lower (0.25f), quieter (0.5f), margin (10.) {}
+
+  void resize (std::size_t size)
+  {
+    if (inputs.size () < size)
+      inputs.resize (size);
+  }
+
+  // Target gain of every input, as of now
+  template <typename F>
+  void update (gint64 now, F apply)
+  {
+    int top = std::numeric_limits<int>::min ();
+    double loudest = -std::numeric_limits<double>::infinity();
+    for (auto&& i : inputs)
+      if (now - i.last_active <= hold)
+        top = std::max (top, i.priority);
+    for (auto&& i : inputs)
+      if (now - i.last_active <= hold && i.priority == top)
+        loudest = std::max (loudest, i.level);
+
+    for (std::size_t index = 0; index != inputs.size (); ++index)
+    {
+      input& i = inputs[index];
+      float target = 1.f;
+      if (i.priority < top)
+        target = lower;
+      else if (i.level < loudest - margin)
+        target = quieter;
+      if (target != i.gain)
+      {
+        i.gain = target;
+        apply (index, target);
+      }
+    }
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,793 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_BABYSITTER_HPP
+#define RTVC_BABYSITTER_HPP
+
+#include <rtvc/pipeline/source.hpp>
+#include <rtvc/pipeline/sound.hpp>
+#include <rtvc/pipeline/visualization.hpp>
+#include <rtvc/pipeline/forward.hpp>
+#include <rtvc/pipeline/stream_switch.hpp>
+#include <rtvc/pipeline/fanout.hpp>
+#include <rtvc/pipeline/dispatcher.hpp>
+#include <rtvc/pipeline/failover.hpp>
+#include <rtvc/pipeline/cry_detector.hpp>
+#include <rtvc/display/power.hpp>
+#include <rtvc/metrics/registry.hpp>
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace rtvc {
+
+/* This function is called when an error message is posted on the bus */
+template <typename F>
+static void error_cb (GstBus *bus, GstMessage *msg, void *data)
+{
+  (*static_cast<F*>(data)) (bus, msg);
+}
+
+template <typename F>
+static void destroy_cb (gpointer data, GClosure*)
+{
+  delete static_cast<F*>(data);
+}
+
+static gboolean destroy_source_cb (gpointer data)
+{
+  delete static_cast<rtvc::pipeline::source*>(data);
+  return G_SOURCE_REMOVE;
+}
+
+// Sources own GLib timers and bus watches, so they are only destroyed
+// on the main loop
+inline void destroy_later (std::unique_ptr<rtvc::pipeline::source> source)
+{
+  if (source)
+    g_idle_add (&destroy_source_cb, source.release ());
+}
+
+// What can differ from one channel to another. A change of replay or
+// stream needs the channel restarted, the rest is retuned in place.
+struct channel_settings
+{
+  // Fed from a capture instead of an NVR, the host being its path
+  bool replay;
+  // 1 for the substream, which is switched to the main stream while
+  // shown, or 0 for the main stream all along
+  int stream;
+  // RMS in dBFS a sample must be above to trigger
+  double threshold;
+  // Milliseconds the channel stays triggered for after a loud sample
+  unsigned int hysteresis;
+  // Volume in the mix, before ducking
+  double gain;
+  // While channels of a higher priority are heard, this one is ducked
+  int priority;
+
+  channel_settings () : replay (false), stream (1), threshold (-10.), hysteresis (20000), gain (1.), priority (0) {}
+
+  bool restarts (channel_settings const& other) const
+  {
+    return replay != other.replay || stream != other.stream;
+  }
+  bool operator== (channel_settings const& other) const
+  {
+    return !restarts (other) && threshold == other.threshold && hysteresis == other.hysteresis
+      && gain == other.gain && priority == other.priority;
+  }
+  bool operator!= (channel_settings const& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+// Everything kept for one camera channel
+struct channel
+{
+  std::string host;
+  int port;
+  int number;
+  // Fed from a capture instead of an NVR
+  bool replay;
+  // Of settings, fixed for the life of the channel since a change
+  // restarts it, so the dispatcher thread reads it as it is
+  int stream;
+  // Main loop only, tune may rewrite it while the dispatcher runs
+  channel_settings settings;
+  // Added by reconfigure, so a later one may retune or remove it,
+  // instead of by hand
+  bool configured;
+  // Of settings, read on the dispatcher thread, hysteresis in
+  // microseconds
+  std::atomic<double> threshold;
+  std::atomic<gint64> hysteresis;
+  // Input of sound_sink this channel is mixed into
+  unsigned int input;
+  std::unique_ptr<rtvc::pipeline::source> primary;
+  // Standby on the failover NVR, if one was given
+  std::unique_ptr<rtvc::pipeline::failover> failover;
+  std::unique_ptr<rtvc::pipeline::forwarder> audio_forward;
+  // G.711 comes undecoded from the source, it is decoded here for the
+  // samples that are played
+  rtvc::audio::g711::decoder audio_decoder;
+  // Source and connection that last fed the mixer input, a new one is
+  // rebased to where the mix is now
+  std::pair<rtvc::pipeline::source const*, unsigned int> feed;
+  // Monotonic time the trigger ends at, 0 while not triggered
+  gint64 trigger_until;
+  // Set by the dispatcher thread and brought about on the main loop:
+  // whether the channel is shown, from which source, and whether its
+  // mixer input has to be brought back into the mix
+  std::atomic<bool> show;
+  std::atomic<rtvc::pipeline::source*> show_from;
+  std::atomic<bool> rejoin;
+  // The rest of the view is main loop only
+  rtvc::pipeline::tile* tile;
+  rtvc::pipeline::source* shown_from;
+  // Shares what the tile shows with local clients, if set
+  std::shared_ptr<rtvc::pipeline::fanout> fanout;
+  // Main stream opened while the channel is on screen
+  std::unique_ptr<rtvc::pipeline::source> main_stream;
+  std::shared_ptr<rtvc::pipeline::dispatcher::entry> main_stream_entry;
+  // Replaced on the main loop, read with atomic_load by the handlers
+  std::shared_ptr<rtvc::pipeline::stream_switch> video_switch;
+  std::vector<std::shared_ptr<rtvc::pipeline::dispatcher::entry>> entries;
+  // Only loud sounds that sound like a cry trigger, if set
+  std::shared_ptr<rtvc::pipeline::cry_detector> cry;
+  // Source whose pre-trigger ring is writing a clip of this trigger
+  rtvc::pipeline::source* clip_source;
+  // Monotonic time of the last trigger until its audio enters the
+  // mixer, then 0
+  std::atomic<gint64> triggered;
+  // From the last trigger to its audio entering the mixer, in
+  // microseconds, -1 before the first
+  std::atomic<gint64> trigger_to_audio;
+
+  channel () : port (0), number (0), replay (false), stream (1), configured (false), threshold (-10.), hysteresis (20000000), input (0), feed (nullptr, 0), trigger_until (0)
+             , show (false), show_from (nullptr), rejoin (false), tile (nullptr), shown_from (nullptr), clip_source (nullptr), triggered (0), trigger_to_audio (-1) {}
+};
+
+// The whole application: channels mixed into sound_sink and shown on
+// visualization while they are loud. Channels are only added and
+// removed on the main loop, the sample handlers run on the dispatcher
+// thread.
+struct babysitter
+{
+  typedef std::tuple<std::string, int, int> channel_key;
+
+  struct settings
+  {
+    std::string user, password;
+    // Empty for no standby
+    std::string failover_host;
+    int failover_port;
+    // Empty for no capture
+    std::string capture_dir;
+    // Empty for no clips, else each trigger is written there with the
+    // pretrigger_seconds before it
+    std::string clip_dir;
+    unsigned int pretrigger_seconds;
+    // Of the stream a clip is cut from, in kbit/s, to size its ring.
+    // Zero picks by stream: enough for a main stream or a substream.
+    unsigned int pretrigger_bitrate;
+    // Loud sounds only trigger if a cry was heard this recently
+    bool cry_detection;
+    gint64 cry_hold;
+    bool replay_fast;
+    unsigned int width, height;
+    bool flip;
+    // Publish the frames of every shown channel to shared memory
+    bool share_frames;
+    // Frames per second the mosaic is composed at, zero for as fast
+    // as the sources
+    unsigned int display_rate;
+    // From a sample leaving a source to it being heard, to start with
+    // when adaptive
+    GstClockTime audio_latency;
+    // Follow the jitter of the sources instead
+    bool adaptive_latency;
+    char const* audio_sink;
+    char const* video_sink;
+
+    settings () : failover_port (0), pretrigger_seconds (10), pretrigger_bitrate (0), cry_detection (false), cry_hold (1000000)
+                , replay_fast (false), width (1280), height (720), flip (false), share_frames (false), display_rate (0)
+                , audio_latency (100 * GST_MSECOND), adaptive_latency (true)
+                , audio_sink ("autoaudiosink"), video_sink ("autovideosink") {}
+  };
+
+  settings config;
+  rtvc::display::power monitor;
+  rtvc::pipeline::sound_sink sound_sink;
+  rtvc::pipeline::visualization visualization;
+  rtvc::metrics::registry metrics;
+  rtvc::pipeline::latency_controller latency;
+  // Latency of the mix, which the video plays at too unless it needs
+  // more itself, followed by a timer on the main loop
+  std::atomic<GstClockTime> audio_latency;
+  // Latency the controller asked for, applied on the main loop, or 0
+  std::atomic<GstClockTime> wanted_latency;
+  guint video_latency_timer;
+  guint main_stream_timer;
+  // An update_cb is on its way to the main loop
+  std::atomic<bool> update_pending;
+  std::unique_ptr<rtvc::pipeline::cry_worker> cry_worker;
+  // Channels by host, port and channel number. Only touched on the
+  // main loop, handlers get their own channel.
+  std::map<channel_key, std::unique_ptr<channel>> channels;
+  // Every handler below runs on the dispatcher thread. Destroyed
+  // first, so none runs while channels go away.
+  rtvc::pipeline::dispatcher dispatcher;
+
+  babysitter (settings const& config)
+    : config (config)
+    , sound_sink (config.audio_sink)
+    , visualization (config.width, config.height, config.flip, config.video_sink, config.display_rate)
+    , latency (rtvc::pipeline::sound_sink::wait (config.audio_latency))
+    , audio_latency (config.audio_latency)
+    , wanted_latency (0)
+    , update_pending (false)
+  {
+    metrics.add ("sound", sound_sink.pipeline);
+    metrics.add ("video", visualization.pipeline);
+    metrics.add (visualization);
+    metrics.add (monitor);
+    // Mixed and composited buffers are new ones: they are counted but
+    // have no age of their own
+    std::shared_ptr<rtvc::metrics::stage> mixer_output (new rtvc::metrics::stage);
+    GstPad* pad = gst_element_get_static_pad (sound_sink.audiomixer, "src");
+    rtvc::metrics::probe (pad, mixer_output);
+    gst_object_unref (pad);
+    metrics.add ("mixer_output", mixer_output);
+    std::shared_ptr<rtvc::metrics::stage> video_sink (new rtvc::metrics::stage);
+    pad = gst_element_get_static_pad (visualization.sink, "sink");
+    rtvc::metrics::probe (pad, video_sink);
+    gst_object_unref (pad);
+    metrics.add ("video_sink", video_sink);
+    if (config.cry_detection)
+      cry_worker.reset (new rtvc::pipeline::cry_worker);
+
+    set_latency (config.audio_latency);
+    gst_pipeline_set_latency (GST_PIPELINE (visualization.pipeline), config.audio_latency);
+    video_latency_timer = g_timeout_add (250, &babysitter::video_latency_cb, this);
+    main_stream_timer = g_timeout_add (250, &babysitter::main_stream_cb, this);
+    // The mixer plays from the start, inputs come and go while it does
+    gst_element_set_state(sound_sink.pipeline, GST_STATE_PLAYING);
+  }
+  ~babysitter ()
+  {
+    g_source_remove (video_latency_timer);
+    g_source_remove (main_stream_timer);
+    // Left pending, so the dispatcher doesn't post another
+    if (update_pending.exchange (true))
+      g_idle_remove_by_data (this);
+  }
+
+  babysitter (babysitter const&) = delete;
+  babysitter& operator=(babysitter const&) = delete;
+
+  // Starts a channel next to the running ones, without touching them.
+  // A replayed channel has the capture path as host.
+  void add_channel (std::string const& host, int port, int number, channel_settings const& settings = channel_settings ())
+  {
+    bool replay = settings.replay;
+    channel_key key (host, port, number);
+    if (channels.count (key))
+    {
+      std::cout << "channel " << number << " of " << host << ":" << port << " already running" << std::endl;
+      return;
+    }
+
+    std::cout << "initializing source" << std::endl;
+    std::unique_ptr<channel> created (new channel);
+    channel& c = *created;
+    c.host = host;
+    c.port = port;
+    c.number = number;
+    c.replay = replay;
+    c.stream = settings.stream;
+    if (replay)
+      c.primary.reset (new rtvc::pipeline::source {host, !config.replay_fast});
+    else
+      c.primary.reset (new rtvc::pipeline::source {host, port, config.user, config.password, number, settings.stream});
+    if (cry_worker)
+      c.cry = cry_worker->add ();
+    c.input = sound_sink.add ();
+    tune (c, settings);
+    c.audio_forward.reset (new rtvc::pipeline::forwarder (sound_sink.appsrc[c.input]));
+    rtvc::pipeline::source& primary = *c.primary;
+    c.audio_forward->stage = std::shared_ptr<rtvc::metrics::stage> (primary.stages, &primary.stages->appsrc_audio);
+    {
+      GstPad* pad = gst_element_get_static_pad (sound_sink.appsrc[c.input], "src");
+      rtvc::metrics::probe (pad, std::shared_ptr<rtvc::metrics::stage> (primary.stages, &primary.stages->mixer));
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, &babysitter::mixer_input_cb, &c, nullptr);
+      gst_object_unref (pad);
+    }
+    metrics.add (primary);
+    latency.add (primary.lateness);
+    channel* pc = &c;
+    rtvc::pipeline::source* from = &primary;
+    c.entries.push_back
+      (dispatcher.add
+       (primary,
+        [this, pc, from] (GstSample* sample, rtvc::audio::level level) { on_audio (*pc, *from, sample, level); },
+        [this, pc, from] (GstSample* sample) { on_video (*pc, *from, sample); }));
+
+    if (!config.capture_dir.empty () && !replay)
+    {
+      std::string file = config.capture_dir + "/" + file_name (primary) + ".rtvc";
+      std::cout << "capturing to " << file << std::endl;
+      primary.capture (std::make_shared<rtvc::capture::writer> (file));
+    }
+    keep (primary, settings.stream);
+    if (config.share_frames)
+      // Large enough for a tile as big as the window in any format
+      c.fanout = std::make_shared<rtvc::pipeline::fanout> ("/rtvc-" + file_name (primary), config.width * config.height * 4);
+
+    if (!config.failover_host.empty () && !replay)
+    {
+      std::cout << "initializing standby source" << std::endl;
+      c.failover.reset
+        (new rtvc::pipeline::failover
+         (primary, std::unique_ptr<rtvc::pipeline::source>
+          (new rtvc::pipeline::source {config.failover_host, config.failover_port, config.user, config.password, number, settings.stream})));
+      rtvc::pipeline::source& standby = *c.failover->standby;
+      metrics.add (*c.failover);
+      // The standby bridges a restart of the primary, so a stall fails
+      // over as soon as it is clearly one
+      primary.health->quick_stall (400);
+      rtvc::pipeline::source* from = &standby;
+      c.entries.push_back
+        (dispatcher.add
+         (standby,
+          [this, pc, from] (GstSample* sample, rtvc::audio::level level) { on_audio (*pc, *from, sample, level); },
+          [this, pc, from] (GstSample* sample) { on_video (*pc, *from, sample); }));
+      standby.health->on_down = [this, pc]
+        {
+          if (pc->failover->on_standby)
+            sound_sink.deactivate (pc->input);
+        };
+      keep (standby, settings.stream);
+      metrics.add (standby);
+      latency.add (standby.lateness);
+    }
+
+    // With a standby up it is started and the mixer input is kept for it
+    primary.health->on_down = [this, pc]
+      {
+        if (pc->failover)
+          pc->failover->promote ();
+        if (!pc->failover || !pc->failover->standby_up ())
+          sound_sink.deactivate (pc->input);
+      };
+
+    GstBus* bus = gst_element_get_bus (primary.pipeline);
+    /* Print error details on the screen */
+    auto error_callback = [] (GstBus *bus, GstMessage *msg)
+     {
+       GError *err;
+       gchar *debug_info;
+
+       gst_message_parse_error (msg, &err, &debug_info);
+       g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
+       g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+
+       if (!strcmp(GST_OBJECT_NAME(msg->src), "dmsssrc"))
+       {
+         // The source restarts itself, see rtvc::pipeline::health
+         std::cout << "Error happened in dmsssrc" << std::endl;
+       }
+
+       g_clear_error (&err);
+       g_free (debug_info);
+     };
+    typedef decltype(error_callback) error_callback_type;
+    g_signal_connect_data (G_OBJECT (bus), "message::error", (GCallback)error_cb<error_callback_type>
+                           , new error_callback_type(error_callback), &destroy_cb<error_callback_type>, GConnectFlags (0));
+    gst_object_unref (GST_OBJECT (bus));
+
+    gst_element_set_state (primary.pipeline, GST_STATE_PLAYING);
+    channels.emplace (key, std::move (created));
+  }
+
+  // Stops a channel and gives its mixer input back, the others play on
+  void remove_channel (std::string const& host, int port, int number)
+  {
+    auto it = channels.find (channel_key (host, port, number));
+    if (it == channels.end ())
+    {
+      std::cout << "channel " << number << " of " << host << ":" << port << " not running" << std::endl;
+      return;
+    }
+
+    channel& c = *it->second;
+    for (auto&& entry : c.entries)
+      dispatcher.remove (entry);
+    dispatcher.sync ();
+    if (c.main_stream_entry)
+    {
+      dispatcher.remove (c.main_stream_entry);
+      dispatcher.sync ();
+    }
+    if (c.tile)
+    {
+      if (c.fanout)
+        c.fanout->detach ();
+      visualization.release (c.tile);
+      if (!visualization.active ())
+        monitor.off ();
+    }
+    if (c.cry)
+      cry_worker->remove (c.cry);
+    metrics.remove (*c.primary);
+    latency.remove (c.primary->lateness);
+    if (c.failover)
+    {
+      metrics.remove (*c.failover);
+      metrics.remove (*c.failover->standby);
+      latency.remove (c.failover->standby->lateness);
+    }
+    // The mixer input goes first, its probe points to the channel
+    sound_sink.remove (c.input);
+    channels.erase (it);
+    // Parked tiles beyond what the channels left can show at once
+    visualization.trim (channels.size ());
+  }
+
+  // Brings the channels of the last configuration to these: the ones
+  // missing are removed, new ones added, those whose stream changed
+  // restarted and the others retuned in place. Channels that didn't
+  // change, and their NVR connections, are left alone, and so are
+  // those added by hand unless wanted lists them, which makes them
+  // part of the configuration from then on.
+  void reconfigure (std::map<channel_key, channel_settings> const& wanted)
+  {
+    std::vector<channel_key> removed;
+    for (auto&& running : channels)
+    {
+      auto it = wanted.find (running.first);
+      if (it == wanted.end () ? running.second->configured : it->second.restarts (running.second->settings))
+        removed.push_back (running.first);
+    }
+    for (auto&& key : removed)
+      remove_channel (std::get<0> (key), std::get<1> (key), std::get<2> (key));
+
+    for (auto&& channel : wanted)
+    {
+      auto it = channels.find (channel.first);
+      if (it == channels.end ())
+      {
+        add_channel (std::get<0> (channel.first), std::get<1> (channel.first), std::get<2> (channel.first), channel.second);
+        it = channels.find (channel.first);
+        if (it == channels.end ())
+          continue;
+      }
+      else if (it->second->settings != channel.second)
+      {
+        std::cout << "retuning channel " << std::get<2> (channel.first) << " of " << std::get<0> (channel.first)
+                  << ":" << std::get<1> (channel.first) << std::endl;
+        tune (*it->second, channel.second);
+      }
+      it->second->configured = true;
+    }
+  }
+
+private:
+  void tune (channel& c, channel_settings const& settings)
+  {
+    c.settings = settings;
+    c.threshold = settings.threshold;
+    c.hysteresis = std::max (1u, settings.hysteresis) * G_GINT64_CONSTANT (1000);
+    sound_sink.priority (c.input, settings.priority);
+    sound_sink.gain (c.input, settings.gain);
+  }
+
+  // Source name made fit for a file name
+  static std::string file_name (rtvc::pipeline::source const& source)
+  {
+    std::string file = source.name;
+    std::replace (file.begin (), file.end (), '/', '_');
+    std::replace (file.begin (), file.end (), ':', '_');
+    return file;
+  }
+
+  // Past the bitrate the ring keeps less than pretrigger_seconds, see
+  // rtvc_pretrigger_truncated_total
+  void keep (rtvc::pipeline::source& source, int stream)
+  {
+    if (config.clip_dir.empty () || !config.pretrigger_seconds)
+      return;
+    // Both streams, with room for a main stream at 8 Mbit/s or a
+    // substream at 2 Mbit/s
+    std::size_t kbits = config.pretrigger_bitrate ? config.pretrigger_bitrate
+      : stream == 0 ? 8192 : 2048;
+    source.keep (std::make_shared<rtvc::capture::pretrigger>
+                 (config.pretrigger_seconds, config.pretrigger_seconds * kbits * 1024 / 8));
+  }
+
+  bool live (channel& c, rtvc::pipeline::source const& from)
+  {
+    return !c.failover || c.failover->live (from);
+  }
+
+  void on_audio (channel& c, rtvc::pipeline::source& from, GstSample* sample, rtvc::audio::level level)
+  {
+    //std::cout << "appsink " << c.input << std::endl;
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    from.clock->observe (buffer, from.health->connection, from.stages->audio);
+    if (!live (c, from))
+      return;
+    from.lateness->add (from.clock->lateness (buffer), latency.wait);
+    if (config.adaptive_latency)
+      latency.update (g_get_monotonic_time (), [this] (GstClockTime wait)
+                      {
+                        wanted_latency = rtvc::pipeline::sound_sink::latency_for_wait (wait);
+                        update ();
+                      });
+    if (c.cry)
+      c.cry->push (sample);
+
+    std::pair<rtvc::pipeline::source const*, unsigned int> feed (&from, from.health->connection);
+    if (c.feed != feed)
+    {
+      // New, reconnected or switched NVR, join the mix where it is now
+      c.feed = feed;
+      c.rejoin = true;
+      update ();
+      c.audio_forward->follow (from.clock, sound_sink.pipeline, &from.stages->audio);
+      c.primary->stages->mixer.follow (&from.stages->audio);
+      play (c, sample, level);
+    }
+    else if ((level.rms > c.threshold && (!c.cry || c.cry->heard (config.cry_hold))) || c.trigger_until != 0)
+    {
+      gint64 now = g_get_monotonic_time ();
+      if (c.trigger_until == 0)
+      {
+        c.trigger_until = now + c.hysteresis;
+        c.triggered = now;
+        c.show_from = &from;
+        c.show = true;
+        update ();
+      }
+      else if (now >= c.trigger_until)
+      {
+        c.trigger_until = 0;
+        c.show = false;
+        update ();
+      }
+      //std::cout << "volume above threshold, pushing" << std::endl;
+      play (c, sample, level);
+    }
+    else
+      silence (c, sample);
+  }
+
+  // From the dispatcher thread, has the main loop bring the channels
+  // to what their handlers want, and the mix to the latency the
+  // controller wants. State changes can block for long, so
+  // they are never made on the dispatcher thread.
+  void update ()
+  {
+    if (!update_pending.exchange (true))
+      g_idle_add (&babysitter::update_cb, this);
+  }
+
+  static gboolean update_cb (gpointer user_data)
+  {
+    babysitter* self = static_cast<babysitter*>(user_data);
+    // First, so what changes while this runs posts another
+    self->update_pending = false;
+    if (GstClockTime latency = self->wanted_latency.exchange (0))
+      self->set_latency (latency);
+    for (auto&& entry : self->channels)
+    {
+      channel& c = *entry.second;
+      if (c.rejoin.exchange (false))
+        self->sound_sink.activate (c.input);
+      if (c.show && !c.tile)
+        self->show (c, *c.show_from.load ());
+      else if (!c.show && c.tile)
+        self->hide (c);
+    }
+    return G_SOURCE_REMOVE;
+  }
+
+  void show (channel& c, rtvc::pipeline::source& from)
+  {
+    c.tile = visualization.attach ();
+    c.shown_from = &from;
+    if (c.fanout)
+      rtvc::pipeline::fanout::attach (c.fanout, c.tile);
+    if (visualization.active () == 1)
+      monitor.on ();
+    // Show the substream right away and move to the main stream, if
+    // it is watched, once it has a keyframe
+    std::shared_ptr<rtvc::pipeline::stream_switch> video_switch
+      (new rtvc::pipeline::stream_switch (c.tile->appsrc, visualization.pipeline, from.clock, &from.stages->video));
+    video_switch->output.stage = std::shared_ptr<rtvc::metrics::stage> (c.primary->stages, &c.primary->stages->appsrc_video);
+    std::atomic_store (&c.video_switch, video_switch);
+    from.enable_video ();
+    if (std::shared_ptr<rtvc::capture::pretrigger> ring = from.pretrigger ())
+    {
+      ring->start (config.clip_dir + "/" + file_name (from) + "-" + std::to_string (g_get_real_time () / 1000000) + ".rtvc");
+      c.clip_source = &from;
+    }
+  }
+
+  void hide (channel& c)
+  {
+    std::cout << "Trigger ended, stopping video" << std::endl;
+    c.primary->disable_video ();
+    if (c.failover)
+      c.failover->standby->disable_video ();
+    std::atomic_store (&c.video_switch, std::shared_ptr<rtvc::pipeline::stream_switch> ());
+    if (c.clip_source)
+    {
+      c.clip_source->pretrigger ()->stop ();
+      c.clip_source = nullptr;
+    }
+    if (c.main_stream_entry)
+    {
+      dispatcher.remove (c.main_stream_entry);
+      dispatcher.sync ();
+      c.main_stream_entry.reset ();
+    }
+    destroy_later (std::move (c.main_stream));
+    if (c.fanout)
+      c.fanout->detach ();
+    visualization.detach (c.tile);
+    c.tile = nullptr;
+    c.shown_from = nullptr;
+    if (!visualization.active ())
+      monitor.off ();
+  }
+
+  // A capture only has the substream. The main stream is only opened
+  // once the substream is shown upscaled: decoders of H.264 and H.265
+  // can't decode smaller, so a larger stream would only be decoded at
+  // full size to be scaled down. That only shows once the tile has a
+  // frame, and changes with the layout, so it is looked at again and
+  // again.
+  static gboolean main_stream_cb (gpointer user_data)
+  {
+    babysitter* self = static_cast<babysitter*>(user_data);
+    for (auto&& entry : self->channels)
+    {
+      channel& c = *entry.second;
+      if (c.tile && !c.main_stream && !c.replay && c.stream != 0 && c.tile->upscaled ())
+        self->watch_main_stream (c, *c.shown_from);
+    }
+    return G_SOURCE_CONTINUE;
+  }
+
+  // The main stream is only watched, its audio is never decoded
+  void watch_main_stream (channel& c, rtvc::pipeline::source const& from)
+  {
+    std::cout << "tile of " << from.name << " upscaled, watching the main stream" << std::endl;
+    bool standby = &from != c.primary.get ();
+    c.main_stream.reset (new rtvc::pipeline::source {standby ? config.failover_host : c.host
+                                                     , standby ? config.failover_port : c.port
+                                                     , config.user, config.password, c.number, 0, false});
+    channel* pc = &c;
+    rtvc::pipeline::source* main = c.main_stream.get ();
+    c.main_stream_entry = dispatcher.add
+      (*c.main_stream, nullptr,
+       [pc, main] (GstSample* sample)
+       {
+         main->clock->observe (gst_sample_get_buffer (sample), main->health->connection, main->stages->video);
+         std::shared_ptr<rtvc::pipeline::stream_switch> video_switch = std::atomic_load (&pc->video_switch);
+         if (!video_switch)
+           return;
+         GstFlowReturn r;
+         if ((r = video_switch->push_main (sample, main->clock, &main->stages->video)) != GST_FLOW_OK)
+         {
+           std::cout << "Error with gst_app_src_push_buffer for view_pipeline, return " << r << std::endl;
+         }
+       });
+    c.main_stream->enable_video ();
+    gst_element_set_state (c.main_stream->pipeline, GST_STATE_PLAYING);
+  }
+
+  void play (channel& c, GstSample* sample, rtvc::audio::level level)
+  {
+    sound_sink.feed (c.input, level);
+    GstSample* decoded = c.audio_decoder (sample);
+    GstFlowReturn r;
+    // Flushing until the main loop brings the input back into the mix
+    if ((r = c.audio_forward->push (decoded)) != GST_FLOW_OK && r != GST_FLOW_FLUSHING)
+    {
+      std::cout << "Error with gst_app_src_push_buffer for sound_sink, return " << r << std::endl;
+    }
+    gst_sample_unref (decoded);
+  }
+
+  // Below threshold: the input is told it is silent for as long as
+  // the sample lasts, without decoding it
+  void silence (channel& c, GstSample* sample)
+  {
+    GstFlowReturn r;
+    if ((r = c.audio_forward->push_gap (sample, rtvc::audio::g711::decoder::size (sample))) != GST_FLOW_OK
+        && r != GST_FLOW_FLUSHING)
+    {
+      std::cout << "Error with gst_app_src_push_buffer for sound_sink, return " << r << std::endl;
+    }
+  }
+
+  // On the main loop
+  void set_latency (GstClockTime latency)
+  {
+    std::cout << "audio latency now " << latency / GST_MSECOND << "ms" << std::endl;
+    sound_sink.latency (latency);
+    audio_latency = latency;
+  }
+
+  // Video plays as late as the audio, so a camera stays in sync, or
+  // as late as its decoders need if that is more. Tiles come and go,
+  // so what they need is queried again and again.
+  static gboolean video_latency_cb (gpointer user_data)
+  {
+    babysitter* self = static_cast<babysitter*>(user_data);
+    GstElement* pipeline = self->visualization.pipeline;
+    GstClockTime latency = self->audio_latency.load ();
+    GstQuery* query = gst_query_new_latency ();
+    if (gst_element_query (pipeline, query))
+    {
+      gboolean live;
+      GstClockTime min, max;
+      gst_query_parse_latency (query, &live, &min, &max);
+      if (live && GST_CLOCK_TIME_IS_VALID (min))
+        latency = std::max (latency, min);
+    }
+    gst_query_unref (query);
+    if (gst_pipeline_get_latency (GST_PIPELINE (pipeline)) != latency)
+    {
+      std::cout << "video latency now " << latency / GST_MSECOND << "ms" << std::endl;
+      gst_pipeline_set_latency (GST_PIPELINE (pipeline), latency);
+    }
+    return G_SOURCE_CONTINUE;
+  }
+
+  void on_video (channel& c, rtvc::pipeline::source& from, GstSample* sample)
+  {
+    //std::cout << "video sample" << std::endl;
+    from.clock->observe (gst_sample_get_buffer (sample), from.health->connection, from.stages->video);
+    std::shared_ptr<rtvc::pipeline::stream_switch> video_switch = std::atomic_load (&c.video_switch);
+    if (!video_switch || !live (c, from))
+      return;
+    GstFlowReturn r;
+    if ((r = video_switch->push_sub (sample)) != GST_FLOW_OK)
+    {
+      std::cout << "Error with gst_app_src_push_buffer for view_pipeline, return " << r << std::endl;
+    }
+  }
+
+  static GstPadProbeReturn mixer_input_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    channel* c = static_cast<channel*>(user_data);
+    gint64 triggered = c->triggered.exchange (0);
+    if (triggered)
+      c->trigger_to_audio = g_get_monotonic_time () - triggered;
+    return GST_PAD_PROBE_OK;
+  }
+};
+
+}
+
+#endif
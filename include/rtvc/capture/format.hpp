@@ -0,0 +1,224 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_CAPTURE_FORMAT_HPP
+#define RTVC_CAPTURE_FORMAT_HPP
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rtvc { namespace capture {
+
+// A capture is the demuxed audio and video elementary streams of one
+// source, as they left dmssdemux: "RTVCCAP1", then records of a header
+// followed by size bytes of payload, in host byte order. A caps record
+// comes before the first buffer of a stream and whenever caps change.
+constexpr char magic[8] = {'R', 'T', 'V', 'C', 'C', 'A', 'P', '1'};
+
+enum class kind : std::uint8_t { caps, buffer };
+enum class stream : std::uint8_t { audio, video };
+
+// The GstBufferFlags bits of GST_BUFFER_FLAGS, which also holds the
+// flags of the mini object
+constexpr std::uint32_t buffer_flags = ~(static_cast<std::uint32_t>(GST_MINI_OBJECT_FLAG_LAST) - 1);
+
+struct record_header
+{
+  std::uint32_t size;
+  // GstBufferFlags
+  std::uint32_t flags;
+  capture::kind kind;
+  capture::stream stream;
+  std::uint8_t reserved[6];
+  std::uint64_t pts, dts, duration;
+};
+
+static_assert (sizeof(record_header) == 40, "record header must have no padding");
+
+inline record_header buffer_header (capture::stream stream, GstBuffer* buffer)
+{
+  record_header header {};
+  header.size = gst_buffer_get_size (buffer);
+  header.kind = kind::buffer;
+  header.stream = stream;
+  header.flags = GST_BUFFER_FLAGS (buffer) & buffer_flags;
+  header.pts = GST_BUFFER_PTS (buffer);
+  header.dts = GST_BUFFER_DTS (buffer);
+  header.duration = GST_BUFFER_DURATION (buffer);
+  return header;
+}
+
+// Appends records to a capture file. Both streams of a source may be
+// written from different streaming threads, which only copy the record
+// into a queue: a thread of its own writes it. If the disk falls behind
+// by more than limit bytes new records are dropped instead of waiting.
+// Video starts, and after a drop resumes, at a keyframe.
+struct writer
+{
+  std::FILE* file;
+  std::size_t limit;
+  std::size_t queued;
+  std::deque<std::vector<char>> records;
+  GstCaps* caps[2];
+  bool keyframe;
+  std::atomic<std::uint64_t> dropped;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread worker;
+
+  writer (std::string const& path, std::size_t limit = 64 * 1024 * 1024)
+    : file (std::fopen (path.c_str (), "wb")), limit (limit), queued (0), caps {nullptr, nullptr}
+    , keyframe (false), dropped (0), stopping (false)
+  {
+    if (!file)
+      throw std::runtime_error ("Couldn't open " + path + " for capture");
+    std::fwrite (magic, sizeof(magic), 1, file);
+    worker = std::thread ([this] { run (); });
+  }
+  // Writes what is queued first
+  ~writer ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+    }
+    wake.notify_one ();
+    worker.join ();
+    for (auto&& c : caps)
+      if (c)
+        gst_caps_unref (c);
+    std::fclose (file);
+  }
+
+  writer (writer const&) = delete;
+  writer& operator=(writer const&) = delete;
+
+  void write (capture::stream stream, GstCaps* stream_caps, GstBuffer* buffer)
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    GstCaps*& last = caps[static_cast<unsigned int>(stream)];
+    if (stream_caps && (!last || !gst_caps_is_equal (last, stream_caps)))
+    {
+      gchar* string = gst_caps_to_string (stream_caps);
+      record_header header {};
+      header.size = std::strlen (string);
+      header.kind = kind::caps;
+      header.stream = stream;
+      // Never dropped, or what follows would be read with other caps
+      queue (header, string, nullptr);
+      g_free (string);
+      gst_caps_replace (&last, stream_caps);
+    }
+
+    record_header header = buffer_header (stream, buffer);
+    if (stream == stream::video)
+    {
+      if (!(header.flags & GST_BUFFER_FLAG_DELTA_UNIT))
+        keyframe = true;
+      if (!keyframe)
+        return;
+    }
+    if (queued + sizeof(header) + header.size > limit)
+    {
+      dropped.fetch_add (1, std::memory_order_relaxed);
+      if (stream == stream::video)
+        keyframe = false;
+      return;
+    }
+    queue (header, nullptr, buffer);
+    lock.unlock ();
+    wake.notify_one ();
+  }
+
+private:
+  // With the lock held
+  void queue (record_header const& header, char const* payload, GstBuffer* buffer)
+  {
+    std::vector<char> record (sizeof(header) + header.size);
+    std::memcpy (record.data (), &header, sizeof(header));
+    if (payload)
+      std::memcpy (record.data () + sizeof(header), payload, header.size);
+    else
+      gst_buffer_extract (buffer, 0, record.data () + sizeof(header), header.size);
+    queued += record.size ();
+    records.push_back (std::move (record));
+  }
+
+  void run ()
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    while (!stopping || !records.empty ())
+    {
+      if (records.empty ())
+      {
+        wake.wait (lock);
+        continue;
+      }
+      std::vector<char> record = std::move (records.front ());
+      records.pop_front ();
+      lock.unlock ();
+      if (std::fwrite (record.data (), record.size (), 1, file) != 1)
+        std::cout << "Couldn't write capture record" << std::endl;
+      lock.lock ();
+      queued -= record.size ();
+    }
+  }
+};
+
+struct reader
+{
+  std::FILE* file;
+
+  reader (std::string const& path)
+    : file (std::fopen (path.c_str (), "rb"))
+  {
+    char header[sizeof(magic)];
+    if (!file)
+      throw std::runtime_error ("Couldn't open capture " + path);
+    if (std::fread (header, sizeof(header), 1, file) != 1 || std::memcmp (header, magic, sizeof(magic)))
+    {
+      std::fclose (file);
+      throw std::runtime_error (path + " is not a capture");
+    }
+  }
+  ~reader ()
+  {
+    std::fclose (file);
+  }
+
+  reader (reader const&) = delete;
+  reader& operator=(reader const&) = delete;
+
+  // False at the end, or at a truncated record
+  bool next (record_header& header, std::vector<char>& payload)
+  {
+    if (std::fread (&header, sizeof(header), 1, file) != 1)
+      return false;
+    payload.resize (header.size);
+    return !header.size || std::fread (payload.data (), header.size, 1, file) == 1;
+  }
+};
+
+} }
+
+#endif
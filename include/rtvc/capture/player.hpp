@@ -0,0 +1,191 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_CAPTURE_PLAYER_HPP
+#define RTVC_CAPTURE_PLAYER_HPP
+
+#include <rtvc/capture/format.hpp>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rtvc { namespace capture {
+
+// Feeds a capture into two appsrcs standing in for the demuxer pads,
+// from its own thread. In real time, each buffer is pushed when it is
+// due and timestamped by the appsrc like a live source would be. Else
+// buffers are pushed as fast as the pipeline takes them, with their
+// recorded timestamps, blocking once a few seconds are queued.
+//
+// The capture is played in a loop for as long as the pipeline runs,
+// each pass going on from where the timestamps of the last one ended,
+// and from the beginning whenever the pipeline is restarted. Only a
+// capture without buffers ends, with EOS.
+struct player
+{
+  GstElement* audio;
+  GstElement* video;
+  std::string path;
+  bool realtime;
+  std::atomic<bool> stopping;
+  std::thread worker;
+
+  player (std::string const& path, bool realtime)
+    : audio (gst_element_factory_make ("appsrc", "audio_appsrc"))
+    , video (gst_element_factory_make ("appsrc", "video_appsrc"))
+    , path (path), realtime (realtime), stopping (false)
+  {
+    if (!audio || !video)
+      throw std::runtime_error ("Couldn't create appsrc plugin");
+    // Kept alive for the worker, whatever happens to the pipeline
+    gst_object_ref_sink (audio);
+    gst_object_ref_sink (video);
+    for (GstElement* src : {audio, video})
+    {
+      g_object_set (G_OBJECT (src), "format", GST_FORMAT_TIME, "is-live", realtime, "do-timestamp", realtime
+                    , "block", TRUE, NULL);
+      gst_app_src_set_stream_type (GST_APP_SRC (src), GST_APP_STREAM_TYPE_STREAM);
+    }
+    // About two seconds of G.711 and of the substream
+    g_object_set (G_OBJECT (audio), "max-bytes", G_GUINT64_CONSTANT (16 * 1024), NULL);
+    g_object_set (G_OBJECT (video), "max-bytes", G_GUINT64_CONSTANT (512 * 1024), NULL);
+    // Fails now instead of on the worker
+    capture::reader check (path);
+    worker = std::thread ([this] { run (); });
+  }
+  // The pipeline must be stopped first, so a blocked push returns
+  ~player ()
+  {
+    stopping = true;
+    worker.join ();
+    gst_object_unref (audio);
+    gst_object_unref (video);
+  }
+
+  player (player const&) = delete;
+  player& operator=(player const&) = delete;
+
+private:
+  void run ()
+  {
+    while (!stopping)
+    {
+      if (!wait ([this] { return GST_STATE (audio) >= GST_STATE_PAUSED; }))
+        return;
+      std::cout << "replaying " << path << std::endl;
+      GstClockTime base = 0;
+      while (play (base))
+        std::cout << "replaying " << path << " again" << std::endl;
+      if (!wait ([this] { return GST_STATE (audio) < GST_STATE_PAUSED; }))
+        return;
+    }
+  }
+
+  template <typename F>
+  bool wait (F ready)
+  {
+    while (!stopping && !ready ())
+      std::this_thread::sleep_for (std::chrono::milliseconds (50));
+    return !stopping;
+  }
+
+  // One pass, with timestamps from base on, which is moved to where
+  // they ended. False if the pipeline stopped before the end, or if
+  // there was nothing to play.
+  bool play (GstClockTime& base)
+  {
+    capture::reader reader (path);
+    record_header header;
+    std::vector<char> payload;
+    GstClockTime first = GST_CLOCK_TIME_NONE, last = GST_CLOCK_TIME_NONE;
+    bool discont[2] = {true, true};
+    auto start = std::chrono::steady_clock::now ();
+    while (!stopping && reader.next (header, payload))
+    {
+      GstElement* target = header.stream == stream::audio ? audio : video;
+      if (header.kind == kind::caps)
+      {
+        std::string string (payload.begin (), payload.end ());
+        GstCaps* caps = gst_caps_from_string (string.c_str ());
+        gst_app_src_set_caps (GST_APP_SRC (target), caps);
+        gst_caps_unref (caps);
+        continue;
+      }
+
+      GstClockTime pts = header.pts;
+      if (GST_CLOCK_TIME_IS_VALID (pts))
+      {
+        if (!GST_CLOCK_TIME_IS_VALID (first))
+          first = pts;
+        if (realtime && pts > first)
+        {
+          auto due = start + std::chrono::nanoseconds (pts - first);
+          while (!stopping && std::chrono::steady_clock::now () < due)
+            std::this_thread::sleep_until (std::min (due, std::chrono::steady_clock::now () + std::chrono::milliseconds (50)));
+        }
+      }
+
+      GstBuffer* buffer = gst_buffer_new_allocate (nullptr, payload.size (), nullptr);
+      gst_buffer_fill (buffer, 0, payload.data (), payload.size ());
+      GST_BUFFER_FLAGS (buffer) |= header.flags & buffer_flags;
+      // Each pass starts over
+      bool& first_of_stream = discont[static_cast<unsigned int>(header.stream)];
+      if (first_of_stream)
+        GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+      first_of_stream = false;
+      if (!realtime && GST_CLOCK_TIME_IS_VALID (first))
+      {
+        GST_BUFFER_PTS (buffer) = GST_CLOCK_TIME_IS_VALID (pts) && pts >= first ? base + pts - first : GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_IS_VALID (header.dts) && header.dts >= first
+          ? base + header.dts - first : GST_CLOCK_TIME_NONE;
+      }
+      GST_BUFFER_DURATION (buffer) = header.duration;
+      if (GST_CLOCK_TIME_IS_VALID (pts) && pts >= first)
+      {
+        GstClockTime end = pts + (GST_CLOCK_TIME_IS_VALID (header.duration) ? header.duration : 0);
+        if (!GST_CLOCK_TIME_IS_VALID (last) || end > last)
+          last = end;
+      }
+      if (gst_app_src_push_buffer (GST_APP_SRC (target), buffer) == GST_FLOW_FLUSHING)
+        return false;
+    }
+    if (stopping)
+      return false;
+    if (!GST_CLOCK_TIME_IS_VALID (last))
+    {
+      gst_app_src_end_of_stream (GST_APP_SRC (audio));
+      gst_app_src_end_of_stream (GST_APP_SRC (video));
+      return false;
+    }
+    // A frame apart, so the first buffers of the next pass don't
+    // collide with the last of this one
+    base += last - first + 40 * GST_MSECOND;
+    if (realtime)
+    {
+      auto due = start + std::chrono::nanoseconds (last - first);
+      while (!stopping && std::chrono::steady_clock::now () < due)
+        std::this_thread::sleep_until (std::min (due, std::chrono::steady_clock::now () + std::chrono::milliseconds (50)));
+    }
+    return !stopping;
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,351 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_CAPTURE_PRETRIGGER_HPP
+#define RTVC_CAPTURE_PRETRIGGER_HPP
+
+#include <rtvc/capture/format.hpp>
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rtvc { namespace capture {
+
+// The last seconds of both demuxed streams of a source, as capture
+// records in an arena allocated once. Each record is contiguous, one
+// that doesn't fit before the end of the arena starts over at the
+// beginning.
+//
+// A clip is the ring from its oldest record on, followed by whatever
+// arrives until it is stopped, written as a capture by a thread of its
+// own. Streaming threads only copy into the arena: records not yet
+// written are never evicted, so if the disk falls behind for longer
+// than the arena lasts new records are dropped instead of waiting, and
+// video then resumes at the next keyframe.
+//
+// The arena is sized for a bitrate. A stream above it evicts records
+// younger than the window to make room, so clips start later than
+// asked, which truncated counts.
+struct pretrigger
+{
+  struct slot
+  {
+    std::size_t offset, size;
+    // Monotonic arrival, in microseconds
+    gint64 time;
+    // Of a caps record, owned until it is evicted
+    GstCaps* caps;
+  };
+
+  std::unique_ptr<char[]> arena;
+  std::size_t capacity;
+  // Write position in the arena
+  std::size_t head;
+  std::vector<slot> slots;
+  // Records in the ring are sequence numbers [begin, end)
+  std::uint64_t begin, end;
+  gint64 window;
+  // Caps of each stream as of the oldest record, the ring holds every
+  // change after that
+  GstCaps* oldest_caps[2];
+  GstCaps* caps[2];
+  // Video is dropped until a keyframe after a record was
+  bool keyframe;
+  // Clip being written: the next record and when it ends
+  bool recording;
+  std::uint64_t next;
+  gint64 until;
+  std::string path;
+  std::atomic<std::uint64_t> dropped, truncated, clips;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread worker;
+
+  // Keeps seconds of both streams, in at most bytes
+  pretrigger (unsigned int seconds, std::size_t bytes)
+    : arena (new char[bytes]), capacity (bytes), head (0)
+    , slots (seconds * 128 + 16), begin (0), end (0), window (seconds * G_GINT64_CONSTANT (1000000))
+    , oldest_caps {nullptr, nullptr}, caps {nullptr, nullptr}, keyframe (true)
+    , recording (false), next (0), until (0)
+    , dropped (0), truncated (0), clips (0), stopping (false)
+  {
+    worker = std::thread ([this] { run (); });
+  }
+  ~pretrigger ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+    }
+    wake.notify_one ();
+    worker.join ();
+    for (GstCaps* c : {oldest_caps[0], oldest_caps[1], caps[0], caps[1]})
+      if (c)
+        gst_caps_unref (c);
+    for (; begin != end; ++begin)
+      if (GstCaps* c = slots[begin % slots.size ()].caps)
+        gst_caps_unref (c);
+  }
+
+  pretrigger (pretrigger const&) = delete;
+  pretrigger& operator=(pretrigger const&) = delete;
+
+  // Called from the streaming threads
+  void push (capture::stream stream, GstCaps* stream_caps, GstBuffer* buffer)
+  {
+    gint64 now = g_get_monotonic_time ();
+    std::unique_lock<std::mutex> lock (mutex);
+    GstCaps*& last = caps[static_cast<unsigned int>(stream)];
+    if (stream_caps && (!last || !gst_caps_is_equal (last, stream_caps)))
+    {
+      // Rare, the string is the only allocation here
+      gchar* string = gst_caps_to_string (stream_caps);
+      record_header header {};
+      header.size = std::strlen (string);
+      header.kind = kind::caps;
+      header.stream = stream;
+      bool stored = store (header, string, nullptr, stream_caps, now);
+      g_free (string);
+      if (!stored)
+        return;
+      gst_caps_replace (&last, stream_caps);
+    }
+
+    record_header header = buffer_header (stream, buffer);
+    if (stream == stream::video)
+    {
+      if (!(header.flags & GST_BUFFER_FLAG_DELTA_UNIT))
+        keyframe = true;
+      // A clip with a hole in a GOP would decode garbage until the next
+      if (!keyframe)
+      {
+        dropped.fetch_add (1, std::memory_order_relaxed);
+        return;
+      }
+    }
+    bool stored = store (header, nullptr, buffer, nullptr, now);
+    if (!stored && stream == stream::video)
+      keyframe = false;
+    if (stored && recording)
+    {
+      lock.unlock ();
+      wake.notify_one ();
+    }
+  }
+
+  // Starts a clip at path with what the ring holds, or keeps the one
+  // being written going
+  void start (std::string const& clip_path)
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      until = G_MAXINT64;
+      if (recording)
+        return;
+      path = clip_path;
+      recording = true;
+      next = begin;
+    }
+    wake.notify_one ();
+  }
+
+  // The clip takes in what arrived until now and ends
+  void stop ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      if (!recording)
+        return;
+      until = g_get_monotonic_time ();
+    }
+    wake.notify_one ();
+  }
+
+private:
+  // With the lock held. Evicts what is too old or in the way, unless
+  // a clip still has to write it, and copies the record in.
+  bool store (record_header const& header, char const* payload, GstBuffer* buffer, GstCaps* record_caps
+              , gint64 now)
+  {
+    std::size_t size = sizeof(header) + header.size;
+    while (begin != end && now - slots[begin % slots.size ()].time > window && evictable ())
+      evict ();
+    std::size_t offset;
+    while (!place (size, offset))
+    {
+      if (begin == end || !evictable ())
+      {
+        dropped.fetch_add (1, std::memory_order_relaxed);
+        return false;
+      }
+      truncated.fetch_add (1, std::memory_order_relaxed);
+      evict ();
+    }
+
+    std::memcpy (&arena[offset], &header, sizeof(header));
+    if (payload)
+      std::memcpy (&arena[offset + sizeof(header)], payload, header.size);
+    else
+      gst_buffer_extract (buffer, 0, &arena[offset + sizeof(header)], header.size);
+    slots[end % slots.size ()] = slot {offset, size, now, record_caps ? gst_caps_ref (record_caps) : nullptr};
+    ++end;
+    head = offset + size;
+    return true;
+  }
+
+  bool evictable () const
+  {
+    return !recording || begin < next;
+  }
+
+  void evict ()
+  {
+    slot& s = slots[begin % slots.size ()];
+    if (s.caps)
+    {
+      record_header header;
+      std::memcpy (&header, &arena[s.offset], sizeof(header));
+      GstCaps*& oldest = oldest_caps[static_cast<unsigned int>(header.stream)];
+      if (oldest)
+        gst_caps_unref (oldest);
+      // Handed over, never parsed back
+      oldest = s.caps;
+      s.caps = nullptr;
+    }
+    ++begin;
+  }
+
+  // Where size bytes go, if they fit between head and the oldest record
+  bool place (std::size_t size, std::size_t& offset)
+  {
+    if (end - begin == slots.size () || size > capacity)
+      return false;
+    if (begin == end)
+    {
+      offset = 0;
+      return true;
+    }
+    std::size_t tail = slots[begin % slots.size ()].offset;
+    if (head > tail)
+    {
+      if (capacity - head >= size)
+        offset = head;
+      else if (tail >= size)
+        offset = 0;
+      else
+        return false;
+      return true;
+    }
+    if (tail - head < size)
+      return false;
+    offset = head;
+    return true;
+  }
+
+  void run ()
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    std::FILE* file = nullptr;
+    // Video before the first keyframe can't be decoded, it is left out
+    bool keyframe = false;
+    while (!stopping)
+    {
+      if (recording && !file)
+      {
+        std::string clip_path = path;
+        GstCaps* initial[2] = {oldest_caps[0] ? gst_caps_ref (oldest_caps[0]) : nullptr
+                               , oldest_caps[1] ? gst_caps_ref (oldest_caps[1]) : nullptr};
+        lock.unlock ();
+        file = std::fopen (clip_path.c_str (), "wb");
+        if (file)
+        {
+          std::cout << "writing clip " << clip_path << std::endl;
+          std::fwrite (magic, sizeof(magic), 1, file);
+          for (unsigned int i = 0; i != 2; ++i)
+            if (initial[i])
+            {
+              gchar* string = gst_caps_to_string (initial[i]);
+              record_header header {};
+              header.size = std::strlen (string);
+              header.kind = kind::caps;
+              header.stream = static_cast<capture::stream>(i);
+              std::fwrite (&header, sizeof(header), 1, file);
+              std::fwrite (string, header.size, 1, file);
+              g_free (string);
+            }
+        }
+        else
+          std::cout << "Couldn't open clip " << clip_path << std::endl;
+        for (GstCaps* c : initial)
+          if (c)
+            gst_caps_unref (c);
+        keyframe = false;
+        lock.lock ();
+        if (!file)
+        {
+          recording = false;
+          continue;
+        }
+      }
+
+      if (recording && next != end && slots[next % slots.size ()].time <= until)
+      {
+        // Not evicted until next moves past it, so it is read unlocked
+        slot s = slots[next % slots.size ()];
+        lock.unlock ();
+        record_header header;
+        std::memcpy (&header, &arena[s.offset], sizeof(header));
+        bool video = header.kind == kind::buffer && header.stream == stream::video;
+        if (video && !(header.flags & GST_BUFFER_FLAG_DELTA_UNIT))
+          keyframe = true;
+        if (!video || keyframe)
+          std::fwrite (&arena[s.offset], s.size, 1, file);
+        lock.lock ();
+        ++next;
+        continue;
+      }
+
+      if (recording && (next != end || g_get_monotonic_time () > until))
+      {
+        // Everything until the end was written
+        recording = false;
+        lock.unlock ();
+        std::fclose (file);
+        file = nullptr;
+        clips.fetch_add (1, std::memory_order_relaxed);
+        lock.lock ();
+        continue;
+      }
+
+      if (recording && until != G_MAXINT64)
+        wake.wait_for (lock, std::chrono::microseconds (until - g_get_monotonic_time () + 1000));
+      else
+        wake.wait (lock);
+    }
+    if (file)
+      std::fclose (file);
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_CAPTURE_TAP_HPP
+#define RTVC_CAPTURE_TAP_HPP
+
+#include <rtvc/capture/format.hpp>
+#include <rtvc/capture/pretrigger.hpp>
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <memory>
+
+namespace rtvc { namespace capture {
+
+// Where the demuxed streams of a source are recorded, if anywhere, and
+// the ring keeping their last seconds, if any. Shared with the pad
+// probes, so it outlives a moved source.
+struct tap
+{
+  std::shared_ptr<capture::writer> target;
+  std::shared_ptr<capture::pretrigger> ring;
+
+  void record (std::shared_ptr<capture::writer> writer)
+  {
+    std::atomic_store (&target, std::move (writer));
+  }
+
+  void keep (std::shared_ptr<capture::pretrigger> pretrigger)
+  {
+    std::atomic_store (&ring, std::move (pretrigger));
+  }
+
+  static void probe (GstPad* pad, std::shared_ptr<tap> tap, capture::stream stream)
+  {
+    struct data
+    {
+      std::shared_ptr<capture::tap> tap;
+      capture::stream stream;
+    };
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER
+                       , [] (GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn
+                         {
+                           data* self = static_cast<data*>(user_data);
+                           std::shared_ptr<capture::writer> writer = std::atomic_load (&self->tap->target);
+                           std::shared_ptr<capture::pretrigger> ring = std::atomic_load (&self->tap->ring);
+                           if (writer || ring)
+                           {
+                             GstCaps* caps = gst_pad_get_current_caps (pad);
+                             if (writer)
+                               writer->write (self->stream, caps, GST_PAD_PROBE_INFO_BUFFER (info));
+                             if (ring)
+                               ring->push (self->stream, caps, GST_PAD_PROBE_INFO_BUFFER (info));
+                             if (caps)
+                               gst_caps_unref (caps);
+                           }
+                           return GST_PAD_PROBE_OK;
+                         }
+                       , new data{std::move (tap), stream}
+                       , [] (gpointer user_data) { delete static_cast<data*>(user_data); });
+  }
+};
+
+} }
+
+#endif
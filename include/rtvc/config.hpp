@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_CONFIG_HPP
+#define RTVC_CONFIG_HPP
+
+#include <rtvc/babysitter.hpp>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace rtvc {
+
+// The value of key, or value when it's missing. Unlike get with a
+// default, one that doesn't convert throws instead of falling back.
+template <typename T>
+T read_setting (boost::property_tree::ptree const& values, char const* key, T value)
+{
+  if (values.get_child_optional (key))
+    return values.get<T> (key);
+  return value;
+}
+
+// Reads the channels of an INI file, one section per channel, named
+// as one likes:
+//
+//   [nursery]
+//   host = nvr.localdomain
+//   port = 37777
+//   channel = 5
+//   stream = 1          ; 0 for the main stream all along
+//   threshold = -10     ; dBFS
+//   hysteresis = 20000  ; ms the channel stays triggered
+//   gain = 1.0
+//   priority = 0
+//
+// or, for a capture, replay = <path> instead of host, port and
+// channel. Only host, port and channel, or replay, are required.
+// Throws std::runtime_error on anything it can't make sense of, so a
+// half written file is never applied.
+inline std::map<babysitter::channel_key, channel_settings> read_channels (std::string const& path)
+{
+  namespace pt = boost::property_tree;
+  pt::ptree tree;
+  std::map<babysitter::channel_key, channel_settings> channels;
+  try
+  {
+    pt::read_ini (path, tree);
+    for (auto&& section : tree)
+    {
+      pt::ptree const& values = section.second;
+      std::string const& name = section.first;
+      channel_settings settings;
+      babysitter::channel_key key;
+      if (auto replay = values.get_optional<std::string> ("replay"))
+      {
+        settings.replay = true;
+        key = babysitter::channel_key (*replay, 0, 0);
+      }
+      else
+        key = babysitter::channel_key (values.get<std::string> ("host"), values.get<int> ("port")
+                                       , values.get<int> ("channel"));
+      settings.stream = read_setting<int> (values, "stream", settings.stream);
+      settings.threshold = read_setting<double> (values, "threshold", settings.threshold);
+      // Signed, so a negative one isn't taken as a huge one
+      int hysteresis = read_setting<int> (values, "hysteresis", settings.hysteresis);
+      settings.gain = read_setting<double> (values, "gain", settings.gain);
+      settings.priority = read_setting<int> (values, "priority", settings.priority);
+
+      if (settings.stream != 0 && settings.stream != 1)
+        throw std::runtime_error ("stream of " + name + " must be 0 or 1");
+      if (settings.replay && settings.stream != 1)
+        throw std::runtime_error ("replay " + name + " only has the substream");
+      if (settings.threshold > 0.)
+        throw std::runtime_error ("threshold of " + name + " must be in dBFS, at most 0");
+      if (hysteresis < 1)
+        throw std::runtime_error ("hysteresis of " + name + " must be at least 1 ms");
+      settings.hysteresis = hysteresis;
+      // Most the mixer pad volume takes
+      if (!(settings.gain >= 0. && settings.gain <= 10.))
+        throw std::runtime_error ("gain of " + name + " must be between 0 and 10");
+      if (!channels.emplace (key, settings).second)
+        throw std::runtime_error ("channel of " + name + " is already in the file");
+    }
+  }
+  // Parse and missing key errors of property_tree included
+  catch (std::runtime_error const& e)
+  {
+    throw std::runtime_error (path + ": " + e.what ());
+  }
+  return channels;
+}
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_DISPLAY_POWER_HPP
+#define RTVC_DISPLAY_POWER_HPP
+
+#include <X11/Xlib.h>
+#include <X11/extensions/dpms.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace rtvc { namespace display {
+
+// Turns the monitor on and off through DPMS from its own thread, so
+// callers on streaming threads only flip a flag. Requests are
+// coalesced: only the last one is applied.
+struct power
+{
+  enum class level { unknown, on, off };
+
+  Display* display;
+  std::mutex mutex;
+  std::condition_variable condition;
+  level requested, applied;
+  std::chrono::steady_clock::time_point requested_at;
+  bool stopping;
+  // The last level applied and how long it took, in microseconds,
+  // read by the metrics
+  std::atomic<level> current;
+  std::atomic<long> last_latency;
+  std::thread worker;
+
+  power ()
+    : display (XOpenDisplay (nullptr))
+    , requested (level::unknown), applied (level::unknown)
+    , stopping (false)
+    , current (level::unknown)
+    , last_latency (-1)
+  {
+    int event_base, error_base;
+    if (!display)
+      std::cout << "Couldn't open X display, monitor power won't be controlled" << std::endl;
+    else if (!DPMSQueryExtension (display, &event_base, &error_base) || !DPMSCapable (display))
+    {
+      std::cout << "X display has no DPMS, monitor power won't be controlled" << std::endl;
+      XCloseDisplay (display);
+      display = nullptr;
+    }
+    worker = std::thread ([this] { run (); });
+  }
+  ~power ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+    }
+    condition.notify_one ();
+    worker.join ();
+    if (display)
+      XCloseDisplay (display);
+  }
+
+  power (power const&) = delete;
+  power& operator=(power const&) = delete;
+
+  void on ()
+  {
+    request (level::on);
+  }
+  void off ()
+  {
+    request (level::off);
+  }
+
+private:
+  void request (level l)
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      if (requested == l)
+        return;
+      requested = l;
+      requested_at = std::chrono::steady_clock::now ();
+    }
+    condition.notify_one ();
+  }
+
+  void run ()
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    while (true)
+    {
+      condition.wait (lock, [this] { return stopping || requested != applied; });
+      if (stopping)
+        return;
+
+      level l = requested;
+      auto since = requested_at;
+      lock.unlock ();
+      apply (l);
+      auto latency = std::chrono::duration_cast<std::chrono::microseconds>
+        (std::chrono::steady_clock::now () - since).count ();
+      last_latency = latency;
+      current = l;
+      lock.lock ();
+      applied = l;
+    }
+  }
+
+  void apply (level l)
+  {
+    if (!display)
+      return;
+    if (l == level::on)
+    {
+      DPMSForceLevel (display, DPMSModeOn);
+      XResetScreenSaver (display);
+    }
+    else
+    {
+      // Forcing a level is ignored while DPMS is disabled
+      DPMSEnable (display);
+      DPMSForceLevel (display, DPMSModeOff);
+    }
+    XSync (display, False);
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_METRICS_EXPORTER_HPP
+#define RTVC_METRICS_EXPORTER_HPP
+
+#include <rtvc/metrics/registry.hpp>
+
+#include <gio/gio.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace rtvc { namespace metrics {
+
+// Serves GET /metrics over HTTP on localhost only. Requests are
+// answered on GIO's own threads, never on the main loop or a
+// streaming thread.
+struct exporter
+{
+  metrics::registry& registry;
+  GSocketService* service;
+
+  exporter (metrics::registry& registry, unsigned short port)
+    : registry (registry), service (g_threaded_socket_service_new (2))
+  {
+    GInetAddress* address = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+    GSocketAddress* socket_address = g_inet_socket_address_new (address, port);
+    GError* error = nullptr;
+    gboolean added = g_socket_listener_add_address (G_SOCKET_LISTENER (service), socket_address, G_SOCKET_TYPE_STREAM
+                                                    , G_SOCKET_PROTOCOL_TCP, nullptr, nullptr, &error);
+    g_object_unref (socket_address);
+    g_object_unref (address);
+    if (!added)
+    {
+      std::string message = error->message;
+      g_error_free (error);
+      g_object_unref (service);
+      throw std::runtime_error ("Couldn't listen for metrics: " + message);
+    }
+
+    g_signal_connect (service, "run", G_CALLBACK (&exporter::run_cb), this);
+    g_socket_service_start (service);
+    std::cout << "metrics on http://127.0.0.1:" << port << "/metrics" << std::endl;
+  }
+  ~exporter ()
+  {
+    g_socket_service_stop (service);
+    g_socket_listener_close (G_SOCKET_LISTENER (service));
+    g_object_unref (service);
+  }
+
+  exporter (exporter const&) = delete;
+  exporter& operator=(exporter const&) = delete;
+
+private:
+  static gboolean run_cb (GThreadedSocketService* service, GSocketConnection* connection
+                          , GObject* source_object, gpointer user_data)
+  {
+    exporter* self = static_cast<exporter*>(user_data);
+    g_socket_set_timeout (g_socket_connection_get_socket (connection), 5);
+
+    // Only the request line matters, the rest of the head is read and
+    // ignored so closing doesn't reset the connection
+    char buffer[4096];
+    gssize size = g_input_stream_read (g_io_stream_get_input_stream (G_IO_STREAM (connection))
+                                       , buffer, sizeof(buffer), nullptr, nullptr);
+    std::string request (buffer, size > 0 ? size : 0);
+
+    std::string status, body;
+    if (request.compare (0, 13, "GET /metrics ") == 0)
+    {
+      status = "200 OK";
+      body = self->registry.expose ();
+    }
+    else
+    {
+      status = "404 Not Found";
+      body = "not found\n";
+    }
+    std::string response = "HTTP/1.0 " + status + "\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: " + std::to_string (body.size ()) + "\r\n"
+      "Connection: close\r\n\r\n" + body;
+    g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (connection))
+                               , response.data (), response.size (), nullptr, nullptr, nullptr);
+    g_io_stream_close (G_IO_STREAM (connection), nullptr, nullptr);
+    return TRUE;
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,237 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_METRICS_REGISTRY_HPP
+#define RTVC_METRICS_REGISTRY_HPP
+
+#include <rtvc/display/power.hpp>
+#include <rtvc/metrics/stage.hpp>
+#include <rtvc/pipeline/failover.hpp>
+#include <rtvc/pipeline/source.hpp>
+#include <rtvc/pipeline/visualization.hpp>
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rtvc { namespace metrics {
+
+// What is exported: sources and their failovers, stages that belong
+// to no single source, pipelines whose latency is reported, the
+// display and the monitor power. A source or failover must be removed
+// before it is destroyed; expose runs on any thread.
+struct registry
+{
+  std::mutex mutex;
+  std::vector<pipeline::source const*> sources;
+  std::vector<pipeline::failover const*> failovers;
+  std::vector<std::pair<std::string, std::shared_ptr<metrics::stage>>> stages;
+  std::vector<std::pair<std::string, GstElement*>> pipelines;
+  pipeline::visualization const* display;
+  display::power const* monitor;
+
+  registry () : display (nullptr), monitor (nullptr) {}
+
+  void add (pipeline::source const& source)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    sources.push_back (&source);
+  }
+  void remove (pipeline::source const& source)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    sources.erase (std::remove (sources.begin (), sources.end (), &source), sources.end ());
+  }
+  void add (pipeline::failover const& failover)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    failovers.push_back (&failover);
+  }
+  void remove (pipeline::failover const& failover)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    failovers.erase (std::remove (failovers.begin (), failovers.end (), &failover), failovers.end ());
+  }
+  void add (pipeline::visualization const& visualization)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    display = &visualization;
+  }
+  void add (display::power const& power)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    monitor = &power;
+  }
+  void add (std::string name, std::shared_ptr<metrics::stage> stage)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    stages.emplace_back (std::move (name), std::move (stage));
+  }
+  void add (std::string name, GstElement* pipeline)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    pipelines.emplace_back (std::move (name), pipeline);
+  }
+
+  // Prometheus text format
+  std::string expose ()
+  {
+    std::ostringstream out;
+    // Latency queries go through every element of a pipeline and may
+    // wait on its streaming threads, so not under the lock
+    std::vector<std::pair<std::string, GstElement*>> queried;
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+
+      // Every stage, with the labels that tell it apart
+      std::vector<std::pair<std::string, metrics::stage const*>> all;
+      for (auto&& source : sources)
+      {
+        source_stages const& s = *source->stages;
+        std::string labels = "source=\"" + source->name + "\",stage=\"";
+        all.emplace_back (labels + "ingress\"", &s.ingress);
+        all.emplace_back (labels + "demux_audio\"", &s.demux_audio);
+        all.emplace_back (labels + "demux_video\"", &s.demux_video);
+        all.emplace_back (labels + "appsink_audio\"", &s.appsink_audio);
+        all.emplace_back (labels + "appsink_video\"", &s.appsink_video);
+        all.emplace_back (labels + "appsrc_audio\"", &s.appsrc_audio);
+        all.emplace_back (labels + "appsrc_video\"", &s.appsrc_video);
+        all.emplace_back (labels + "mixer\"", &s.mixer);
+      }
+      for (auto&& stage : stages)
+        all.emplace_back ("source=\"\",stage=\"" + stage.first + "\"", stage.second.get ());
+
+      out << "# HELP rtvc_stage_latency_seconds Time since the buffer left the demuxer\n"
+          << "# TYPE rtvc_stage_latency_seconds histogram\n";
+      for (auto&& stage : all)
+        stage.second->latency.write (out, "rtvc_stage_latency_seconds", stage.first);
+      out << "# HELP rtvc_stage_interval_seconds Time between consecutive buffers\n"
+          << "# TYPE rtvc_stage_interval_seconds histogram\n";
+      for (auto&& stage : all)
+        stage.second->interval.write (out, "rtvc_stage_interval_seconds", stage.first);
+      out << "# HELP rtvc_stage_buffers_total Buffers through the stage\n"
+          << "# TYPE rtvc_stage_buffers_total counter\n";
+      for (auto&& stage : all)
+        out << "rtvc_stage_buffers_total{" << stage.first << "} " << stage.second->buffers.load () << '\n';
+      out << "# HELP rtvc_stage_bytes_total Bytes through the stage\n"
+          << "# TYPE rtvc_stage_bytes_total counter\n";
+      for (auto&& stage : all)
+        out << "rtvc_stage_bytes_total{" << stage.first << "} " << stage.second->bytes.load () << '\n';
+
+      out << "# HELP rtvc_ring_dropped_total Samples dropped between the streaming and the dispatcher thread\n"
+          << "# TYPE rtvc_ring_dropped_total counter\n";
+      for (auto&& source : sources)
+      {
+        out << "rtvc_ring_dropped_total{source=\"" << source->name << "\",stream=\"audio\"} "
+            << source->audio_ring->dropped.load () + source->g711_ring->dropped.load () << '\n';
+        out << "rtvc_ring_dropped_total{source=\"" << source->name << "\",stream=\"video\"} "
+            << source->video_ring->dropped.load () << '\n';
+      }
+      out << "# HELP rtvc_pretrigger_dropped_total Records dropped because a clip fell behind\n"
+          << "# TYPE rtvc_pretrigger_dropped_total counter\n";
+      for (auto&& source : sources)
+        if (std::shared_ptr<capture::pretrigger> ring = source->pretrigger ())
+          out << "rtvc_pretrigger_dropped_total{source=\"" << source->name << "\"} " << ring->dropped.load () << '\n';
+      out << "# HELP rtvc_pretrigger_truncated_total Records evicted before the pretrigger window was over, for want of room\n"
+          << "# TYPE rtvc_pretrigger_truncated_total counter\n";
+      for (auto&& source : sources)
+        if (std::shared_ptr<capture::pretrigger> ring = source->pretrigger ())
+          out << "rtvc_pretrigger_truncated_total{source=\"" << source->name << "\"} " << ring->truncated.load () << '\n';
+      out << "# HELP rtvc_source_reconnects_total Times the source came back after going down\n"
+          << "# TYPE rtvc_source_reconnects_total counter\n";
+      for (auto&& source : sources)
+        out << "rtvc_source_reconnects_total{source=\"" << source->name << "\"} " << source->health->reconnects.load () << '\n';
+      out << "# HELP rtvc_source_downtime_seconds_total Time the source spent down\n"
+          << "# TYPE rtvc_source_downtime_seconds_total counter\n";
+      for (auto&& source : sources)
+        out << "rtvc_source_downtime_seconds_total{source=\"" << source->name << "\"} " << source->health->downtime.load () / 1e6 << '\n';
+      out << "# HELP rtvc_source_jitter_seconds Percentile of how late audio reaches the dispatcher past its mapped time\n"
+          << "# TYPE rtvc_source_jitter_seconds gauge\n";
+      for (auto&& source : sources)
+        out << "rtvc_source_jitter_seconds{source=\"" << source->name << "\",quantile=\"0.99\"} "
+            << static_cast<double> (source->lateness->percentile.load ()) / GST_SECOND << '\n';
+      out << "# HELP rtvc_source_underruns_total Audio buffers that came after the mixer stopped waiting for them\n"
+          << "# TYPE rtvc_source_underruns_total counter\n";
+      for (auto&& source : sources)
+        out << "rtvc_source_underruns_total{source=\"" << source->name << "\"} " << source->lateness->underruns.load () << '\n';
+      out << "# HELP rtvc_source_up Whether the source is delivering\n"
+          << "# TYPE rtvc_source_up gauge\n";
+      for (auto&& source : sources)
+        out << "rtvc_source_up{source=\"" << source->name << "\"} " << source->health->up () << '\n';
+
+      out << "# HELP rtvc_failover_switches_total Times the channel switched between its primary and standby\n"
+          << "# TYPE rtvc_failover_switches_total counter\n";
+      for (auto&& failover : failovers)
+        out << "rtvc_failover_switches_total{source=\"" << failover->primary->name << "\"} " << failover->switches.load () << '\n';
+      out << "# HELP rtvc_failover_on_standby Whether the channel is fed by its standby\n"
+          << "# TYPE rtvc_failover_on_standby gauge\n";
+      for (auto&& failover : failovers)
+        out << "rtvc_failover_on_standby{source=\"" << failover->primary->name << "\"} " << failover->on_standby.load () << '\n';
+
+      if (display)
+      {
+        out << "# HELP rtvc_display_overloaded Whether the display is skipping frames to keep up\n"
+            << "# TYPE rtvc_display_overloaded gauge\n"
+            << "rtvc_display_overloaded " << display->qos.overloaded.load () << '\n';
+        gint64 first_frame = display->time_to_first_frame.load ();
+        if (first_frame >= 0)
+          out << "# HELP rtvc_display_first_frame_seconds Time from showing the last tile to its first frame\n"
+              << "# TYPE rtvc_display_first_frame_seconds gauge\n"
+              << "rtvc_display_first_frame_seconds " << first_frame / 1e6 << '\n';
+      }
+      if (monitor)
+      {
+        out << "# HELP rtvc_monitor_on Whether the monitor was last turned on\n"
+            << "# TYPE rtvc_monitor_on gauge\n"
+            << "rtvc_monitor_on " << (monitor->current.load () == display::power::level::on) << '\n';
+        long took = monitor->last_latency.load ();
+        if (took >= 0)
+          out << "# HELP rtvc_monitor_switch_seconds Time the last power change took to apply\n"
+              << "# TYPE rtvc_monitor_switch_seconds gauge\n"
+              << "rtvc_monitor_switch_seconds " << took / 1e6 << '\n';
+      }
+
+      for (auto&& pipeline : pipelines)
+      {
+        gst_object_ref (pipeline.second);
+        queried.push_back (pipeline);
+      }
+    }
+
+    out << "# HELP rtvc_pipeline_latency_seconds Latency configured on the pipeline and reported by its elements\n"
+        << "# TYPE rtvc_pipeline_latency_seconds gauge\n";
+    for (auto&& pipeline : queried)
+    {
+      out << "rtvc_pipeline_latency_seconds{pipeline=\"" << pipeline.first << "\",kind=\"configured\"} "
+          << static_cast<double> (gst_pipeline_get_latency (GST_PIPELINE (pipeline.second))) / GST_SECOND << '\n';
+      GstQuery* query = gst_query_new_latency ();
+      if (gst_element_query (pipeline.second, query))
+      {
+        gboolean live;
+        GstClockTime min, max;
+        gst_query_parse_latency (query, &live, &min, &max);
+        out << "rtvc_pipeline_latency_seconds{pipeline=\"" << pipeline.first << "\",kind=\"reported\"} "
+            << static_cast<double> (min) / GST_SECOND << '\n';
+      }
+      gst_query_unref (query);
+      gst_object_unref (pipeline.second);
+    }
+    return out.str ();
+  }
+};
+
+} }
+
+#endif
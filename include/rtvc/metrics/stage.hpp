@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_METRICS_STAGE_HPP
+#define RTVC_METRICS_STAGE_HPP
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace rtvc { namespace metrics {
+
+// Monotonic time buffers of one stream of a source came out of the
+// demuxer, by timestamp. The timestamp is kept by queues, decoders and
+// the forwarders to other pipelines, so every later stage of the
+// source knows how old a buffer is without anything being attached to
+// it: stamping neither allocates nor makes the buffer writable.
+//
+// A table indexed by the timestamp in milliseconds, so it remembers
+// the last seconds. An entry overwritten or being written meanwhile is
+// just not found. Stamped on the demuxer streaming thread, looked up
+// from any thread.
+struct ingress_times
+{
+  static constexpr std::size_t size = 4096;
+
+  struct entry
+  {
+    std::atomic<GstClockTime> timestamp;
+    std::atomic<gint64> arrival;
+  };
+  entry entries[size];
+
+  ingress_times ()
+  {
+    for (auto&& e : entries)
+    {
+      e.timestamp.store (GST_CLOCK_TIME_NONE, std::memory_order_relaxed);
+      e.arrival.store (0, std::memory_order_relaxed);
+    }
+  }
+
+  ingress_times (ingress_times const&) = delete;
+  ingress_times& operator=(ingress_times const&) = delete;
+
+  void stamp (GstBuffer* buffer, gint64 now)
+  {
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+    if (!GST_CLOCK_TIME_IS_VALID (timestamp))
+      return;
+    entry& e = at (timestamp);
+    e.timestamp.store (GST_CLOCK_TIME_NONE, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    e.arrival.store (now, std::memory_order_relaxed);
+    e.timestamp.store (timestamp, std::memory_order_release);
+  }
+
+  // In nanoseconds, as GstClockTime
+  bool find (GstBuffer* buffer, GstClockTime& time) const
+  {
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+    if (!GST_CLOCK_TIME_IS_VALID (timestamp))
+      return false;
+    entry const& e = at (timestamp);
+    if (e.timestamp.load (std::memory_order_acquire) != timestamp)
+      return false;
+    gint64 arrival = e.arrival.load (std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_acquire);
+    if (e.timestamp.load (std::memory_order_relaxed) != timestamp)
+      return false;
+    time = arrival * GST_USECOND;
+    return true;
+  }
+
+private:
+  entry& at (GstClockTime timestamp)
+  {
+    return entries[(timestamp / GST_MSECOND) % size];
+  }
+  entry const& at (GstClockTime timestamp) const
+  {
+    return entries[(timestamp / GST_MSECOND) % size];
+  }
+};
+
+// Histogram of durations with fixed buckets, lock free
+struct histogram
+{
+  static constexpr unsigned int size = 12;
+
+  // Upper bound of bucket i, in microseconds
+  static std::int64_t bound (unsigned int i)
+  {
+    static const std::int64_t bounds[size] = {1000, 2500, 5000, 10000, 25000, 50000, 100000
+                                              , 250000, 500000, 1000000, 2500000, 5000000};
+    return bounds[i];
+  }
+
+  std::atomic<std::uint64_t> buckets[size + 1];
+  std::atomic<std::uint64_t> sum, count;
+
+  histogram () : sum (0), count (0)
+  {
+    for (auto&& bucket : buckets)
+      bucket = 0;
+  }
+
+  void observe (std::int64_t microseconds)
+  {
+    if (microseconds < 0)
+      microseconds = 0;
+    unsigned int i = 0;
+    while (i != size && microseconds > bound (i))
+      ++i;
+    buckets[i].fetch_add (1, std::memory_order_relaxed);
+    sum.fetch_add (microseconds, std::memory_order_relaxed);
+    count.fetch_add (1, std::memory_order_relaxed);
+  }
+
+  // Prometheus text format, labels without braces
+  void write (std::ostream& out, std::string const& name, std::string const& labels) const
+  {
+    std::uint64_t cumulative = 0;
+    for (unsigned int i = 0; i != size; ++i)
+    {
+      cumulative += buckets[i].load (std::memory_order_relaxed);
+      out << name << "_bucket{" << labels << ",le=\"" << bound (i) / 1e6 << "\"} " << cumulative << '\n';
+    }
+    cumulative += buckets[size].load (std::memory_order_relaxed);
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << cumulative << '\n';
+    out << name << "_sum{" << labels << "} " << sum.load (std::memory_order_relaxed) / 1e6 << '\n';
+    out << name << "_count{" << labels << "} " << count.load (std::memory_order_relaxed) << '\n';
+  }
+};
+
+// One point buffers go through: how many, how big, how far apart and
+// how long since they left the demuxer, if it knows the ingress times
+// of the stream it sees, which may change on failover
+struct stage
+{
+  histogram latency, interval;
+  std::atomic<std::uint64_t> buffers, bytes;
+  std::atomic<gint64> last;
+  std::atomic<ingress_times const*> times;
+
+  stage (ingress_times const* times = nullptr) : buffers (0), bytes (0), last (0), times (times) {}
+
+  void follow (ingress_times const* times)
+  {
+    this->times.store (times, std::memory_order_release);
+  }
+
+  stage (stage const&) = delete;
+  stage& operator=(stage const&) = delete;
+
+  void record (GstBuffer* buffer)
+  {
+    record (buffer, times.load (std::memory_order_acquire));
+  }
+
+  void record (GstBuffer* buffer, ingress_times const* times)
+  {
+    gint64 now = g_get_monotonic_time ();
+    buffers.fetch_add (1, std::memory_order_relaxed);
+    bytes.fetch_add (gst_buffer_get_size (buffer), std::memory_order_relaxed);
+    gint64 previous = last.exchange (now, std::memory_order_relaxed);
+    if (previous)
+      interval.observe (now - previous);
+    GstClockTime time;
+    if (times && times->find (buffer, time))
+      latency.observe (now - static_cast<gint64>(time / GST_USECOND));
+  }
+
+  // Where buffers leave the demuxer, and so are as old as can be,
+  // into the times it was built with
+  void stamp (GstBuffer* buffer, ingress_times& times)
+  {
+    gint64 now = g_get_monotonic_time ();
+    times.stamp (buffer, now);
+    buffers.fetch_add (1, std::memory_order_relaxed);
+    bytes.fetch_add (gst_buffer_get_size (buffer), std::memory_order_relaxed);
+    gint64 previous = last.exchange (now, std::memory_order_relaxed);
+    if (previous)
+      interval.observe (now - previous);
+    latency.observe (0);
+  }
+};
+
+// Every stage of one source, shared with the probes that record them
+struct source_stages
+{
+  ingress_times audio, video;
+  // Before the demuxer, no age
+  stage ingress;
+  stage demux_audio, demux_video;
+  stage appsink_audio, appsink_video;
+  stage appsrc_audio, appsrc_video;
+  // Entering the mixer, after the hop to the sound pipeline
+  stage mixer;
+
+  source_stages ()
+    : demux_audio (&audio), demux_video (&video)
+    , appsink_audio (&audio), appsink_video (&video)
+    , appsrc_audio (&audio), appsrc_video (&video)
+    , mixer (&audio)
+  {}
+};
+
+// Records every buffer through pad into stage. With stamp, their
+// ingress time is stored there instead, which is done once, where they
+// leave the demuxer. stamp must live as long as stage.
+inline void probe (GstPad* pad, std::shared_ptr<stage> stage, ingress_times* stamp = nullptr)
+{
+  struct data
+  {
+    std::shared_ptr<metrics::stage> stage;
+    ingress_times* stamp;
+  };
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER
+                     , [] (GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn
+                       {
+                         data* self = static_cast<data*>(user_data);
+                         GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+                         if (self->stamp)
+                           self->stage->stamp (buffer, *self->stamp);
+                         else
+                           self->stage->record (buffer);
+                         return GST_PAD_PROBE_OK;
+                       }
+                     , new data{std::move (stage), stamp}
+                     , [] (gpointer user_data) { delete static_cast<data*>(user_data); });
+}
+
+} }
+
+#endif
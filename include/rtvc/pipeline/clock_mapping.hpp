@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_CLOCK_MAPPING_HPP
+#define RTVC_PIPELINE_CLOCK_MAPPING_HPP
+
+#include <rtvc/metrics/stage.hpp>
+
+#include <gst/gst.h>
+
+#include <algorithm>
+
+namespace rtvc { namespace pipeline {
+
+// Relates the timestamps of one source, audio and video alike, to the
+// monotonic clock the output pipelines run on, so both media of a
+// camera land on one timeline.
+//
+// The offset is the lowest arrival time minus timestamp seen: buffers
+// only ever arrive late, by the network and the NVR, never early. A
+// lower one moves it down at once, otherwise it only creeps up by
+// max_drift of the time elapsed, so a late burst barely moves it but
+// a source clock running slower than ours is still followed. A new
+// connection or a jump of more than a second maps it anew.
+//
+// Observed and read on the dispatcher thread.
+struct clock_mapping
+{
+  // Monotonic time of a timestamp, in nanoseconds, is timestamp + offset
+  gint64 offset;
+  gint64 first_offset;
+  GstClockTime first, last;
+  unsigned int connection;
+  // Bumped whenever it is mapped anew
+  unsigned int epoch;
+  bool mapped;
+  double max_drift;
+
+  clock_mapping ()
+    : offset (0), first_offset (0), first (0), last (0), connection (0), epoch (0), mapped (false)
+    , max_drift (200e-6)
+  {}
+
+  // times are the ingress times of the buffer's stream
+  void observe (GstBuffer* buffer, unsigned int connection, metrics::ingress_times const& times)
+  {
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+    if (!GST_CLOCK_TIME_IS_VALID (timestamp))
+      return;
+    GstClockTime arrival;
+    // When it left the demuxer, before any decoding
+    if (!times.find (buffer, arrival))
+      arrival = g_get_monotonic_time () * GST_USECOND;
+    gint64 observed = static_cast<gint64> (arrival) - static_cast<gint64> (timestamp);
+
+    if (!mapped || connection != this->connection
+        || observed > offset + static_cast<gint64> (GST_SECOND))
+    {
+      offset = first_offset = observed;
+      first = last = timestamp;
+      this->connection = connection;
+      ++epoch;
+      mapped = true;
+      return;
+    }
+
+    gint64 creep = 0;
+    if (timestamp > last)
+    {
+      creep = static_cast<gint64> ((timestamp - last) * max_drift);
+      last = timestamp;
+    }
+    offset = std::min (observed, offset + creep);
+  }
+
+  // How late the buffer is now, past the time it maps to
+  gint64 lateness (GstBuffer* buffer) const
+  {
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+    if (!mapped || !GST_CLOCK_TIME_IS_VALID (timestamp))
+      return 0;
+    return g_get_monotonic_time () * GST_USECOND - (static_cast<gint64> (timestamp) + offset);
+  }
+
+  // How much faster than ours the source clock runs, in parts per million
+  double drift () const
+  {
+    if (last <= first)
+      return 0.;
+    return -static_cast<double> (offset - first_offset) / (last - first) * 1e6;
+  }
+};
+
+} }
+
+#endif
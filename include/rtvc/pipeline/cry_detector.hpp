@@ -0,0 +1,190 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_CRY_DETECTOR_HPP
+#define RTVC_PIPELINE_CRY_DETECTOR_HPP
+
+#include <rtvc/audio/cry.hpp>
+#include <rtvc/audio/g711.hpp>
+#include <rtvc/pipeline/sample_ring.hpp>
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rtvc { namespace pipeline {
+
+// Classifies the decoded audio of one channel. Samples are queued by
+// the dispatcher and analyzed on the cry_worker thread, the trigger
+// only reads when a cry was last heard.
+struct cry_detector
+{
+  sample_ring ring;
+  std::unique_ptr<audio::cry_classifier> classifier;
+  // Monotonic time of the last frame that completed a cry, 0 if none
+  std::atomic<gint64> last_cry;
+  std::atomic<bool> removed;
+
+  cry_detector () : ring (64), last_cry (0), removed (false) {}
+
+  cry_detector (cry_detector const&) = delete;
+  cry_detector& operator=(cry_detector const&) = delete;
+
+  // Takes its own reference
+  void push (GstSample* sample)
+  {
+    ring.push (gst_sample_ref (sample));
+  }
+
+  // Whether a cry was heard in the last microseconds
+  bool heard (gint64 microseconds) const
+  {
+    gint64 last = last_cry.load ();
+    return last && g_get_monotonic_time () - last <= microseconds;
+  }
+
+  // On the worker thread
+  void analyze (GstSample* sample)
+  {
+    GstCaps* caps = gst_sample_get_caps (sample);
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    if (!caps || !buffer)
+      return;
+    // Undecoded G.711, see source::compressed_level
+    if (audio::g711::table const* table = audio::g711::table::from_caps (caps))
+    {
+      gint rate = 8000, channels = 1;
+      GstStructure const* s = gst_caps_get_structure (caps, 0);
+      gst_structure_get_int (s, "rate", &rate);
+      gst_structure_get_int (s, "channels", &channels);
+      if (channels < 1 || channels > 256)
+        return;
+      classify (rate);
+      GstMapInfo map;
+      if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+        return;
+      std::int16_t block[256];
+      for (std::size_t offset = 0; offset + channels <= map.size; )
+      {
+        std::size_t count = std::min<std::size_t> ((map.size - offset) / channels * channels, 256 / channels * channels);
+        table->decode (map.data + offset, block, count);
+        classifier->add_s16 (block, count / channels, channels);
+        offset += count;
+      }
+      gst_buffer_unmap (buffer, &map);
+      update ();
+      return;
+    }
+
+    GstAudioInfo info;
+    if (!gst_audio_info_from_caps (&info, caps) || !GST_AUDIO_INFO_CHANNELS (&info))
+      return;
+    unsigned int channels = GST_AUDIO_INFO_CHANNELS (&info);
+    classify (GST_AUDIO_INFO_RATE (&info));
+
+    GstMapInfo map;
+    if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+      return;
+    if (GST_AUDIO_INFO_FORMAT (&info) == GST_AUDIO_FORMAT_S16)
+      classifier->add_s16 (reinterpret_cast<std::int16_t const*>(map.data), map.size / sizeof(std::int16_t) / channels, channels);
+    else if (GST_AUDIO_INFO_FORMAT (&info) == GST_AUDIO_FORMAT_F32)
+      classifier->add_f32 (reinterpret_cast<float const*>(map.data), map.size / sizeof(float) / channels, channels);
+    gst_buffer_unmap (buffer, &map);
+    update ();
+  }
+
+private:
+  void classify (unsigned int rate)
+  {
+    if (!classifier || classifier->rate != rate)
+      classifier.reset (new audio::cry_classifier (rate));
+  }
+
+  void update ()
+  {
+    if (classifier->score () >= 0.4 || classifier->onset ())
+      last_cry = g_get_monotonic_time ();
+  }
+};
+
+// One thread analyzing every channel, so the spectra never run on the
+// dispatcher or a streaming thread
+struct cry_worker
+{
+  rtvc::pipeline::wakeup wakeup;
+  std::atomic<bool> stopping;
+  std::mutex mutex;
+  std::vector<std::shared_ptr<cry_detector>> detectors;
+  std::thread worker;
+
+  cry_worker ()
+    : stopping (false)
+  {
+    worker = std::thread ([this] { run (); });
+  }
+  ~cry_worker ()
+  {
+    stopping = true;
+    wakeup.interrupt ();
+    worker.join ();
+    for (auto&& d : detectors)
+      d->ring.target = nullptr;
+  }
+
+  cry_worker (cry_worker const&) = delete;
+  cry_worker& operator=(cry_worker const&) = delete;
+
+  std::shared_ptr<cry_detector> add ()
+  {
+    std::shared_ptr<cry_detector> d (new cry_detector);
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      detectors.push_back (d);
+    }
+    d->ring.target = &wakeup;
+    return d;
+  }
+
+  void remove (std::shared_ptr<cry_detector> const& d)
+  {
+    d->removed = true;
+    d->ring.target = nullptr;
+    wakeup.notify ();
+  }
+
+private:
+  void run ()
+  {
+    std::vector<std::shared_ptr<cry_detector>> round;
+    while (wakeup.wait ([this] { return stopping.load (); }))
+    {
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        detectors.erase (std::remove_if (detectors.begin (), detectors.end ()
+                                         , [] (std::shared_ptr<cry_detector> const& d) { return d->removed.load (); })
+                         , detectors.end ());
+        round = detectors;
+      }
+      for (auto&& d : round)
+        d->ring.drain ([&] (GstSample* sample, audio::level) { d->analyze (sample); });
+      round.clear ();
+    }
+  }
+};
+
+} }
+
+#endif
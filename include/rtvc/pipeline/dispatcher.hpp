@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_DISPATCHER_HPP
+#define RTVC_PIPELINE_DISPATCHER_HPP
+
+#include <rtvc/pipeline/source.hpp>
+#include <rtvc/pipeline/sample_ring.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rtvc { namespace pipeline {
+
+// Drains the sample rings of every registered source on one thread
+// and runs the handlers there. Streaming threads only enqueue, so
+// however slow a handler is, it never holds up a source. Handlers
+// may add and remove sources themselves.
+struct dispatcher
+{
+  typedef std::function<void (GstSample*, audio::level)> audio_handler;
+  typedef std::function<void (GstSample*)> video_handler;
+
+  struct entry
+  {
+    // Audio comes decoded or, from another thread, as G.711
+    std::shared_ptr<sample_ring> audio, g711, video;
+    audio_handler on_audio;
+    video_handler on_video;
+    std::atomic<bool> removed;
+
+    entry () : removed (false) {}
+  };
+
+  rtvc::pipeline::wakeup wakeup;
+  std::atomic<bool> stopping;
+  std::mutex mutex;
+  std::vector<std::shared_ptr<entry>> added;
+  std::vector<std::shared_ptr<entry>> entries;
+  std::condition_variable round_done;
+  std::uint64_t rounds;
+  std::thread worker;
+
+  dispatcher ()
+    : stopping (false), rounds (0)
+  {
+    worker = std::thread ([this] { run (); });
+  }
+  ~dispatcher ()
+  {
+    stopping = true;
+    wakeup.interrupt ();
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+    }
+    round_done.notify_all ();
+    worker.join ();
+    for (auto&& e : added)
+      remove (e);
+    for (auto&& e : entries)
+      remove (e);
+  }
+
+  dispatcher (dispatcher const&) = delete;
+  dispatcher& operator=(dispatcher const&) = delete;
+
+  // Either handler may be empty, that stream is then dropped by the
+  // source as it arrives
+  std::shared_ptr<entry> add (source& s, audio_handler on_audio, video_handler on_video)
+  {
+    std::shared_ptr<entry> e (new entry);
+    e->audio = s.audio_ring;
+    e->g711 = s.g711_ring;
+    e->video = s.video_ring;
+    e->on_audio = std::move (on_audio);
+    e->on_video = std::move (on_video);
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      added.push_back (e);
+    }
+    if (e->on_audio)
+    {
+      e->audio->target = &wakeup;
+      e->g711->target = &wakeup;
+    }
+    if (e->on_video)
+      e->video->target = &wakeup;
+    return e;
+  }
+
+  // No handler of e runs after this returns, when called from a
+  // handler, or after the handler currently running otherwise
+  void remove (std::shared_ptr<entry> const& e)
+  {
+    e->removed = true;
+    e->audio->target = nullptr;
+    e->g711->target = nullptr;
+    e->video->target = nullptr;
+    wakeup.notify ();
+  }
+
+  // Returns once the round in progress, or the next one if none is,
+  // is over. After remove, no handler of that entry runs anymore and
+  // what it used can be destroyed. Never called from a handler.
+  void sync ()
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    std::uint64_t target = rounds + 1;
+    wakeup.notify ();
+    round_done.wait (lock, [&] { return rounds >= target || stopping.load (); });
+  }
+
+private:
+  void run ()
+  {
+    while (wakeup.wait ([this] { return stopping.load (); }))
+    {
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        entries.insert (entries.end (), added.begin (), added.end ());
+        added.clear ();
+      }
+
+      // Entries added by handlers are picked up on the next round
+      for (auto&& p : entries)
+      {
+        entry& e = *p;
+        auto on_audio = [&] (GstSample* sample, audio::level level)
+                        {
+                          if (!e.removed)
+                            e.on_audio (sample, level);
+                        };
+        if (!e.removed && e.on_audio)
+        {
+          e.audio->drain (on_audio);
+          e.g711->drain (on_audio);
+        }
+        if (!e.removed && e.on_video)
+          e.video->drain ([&] (GstSample* sample, audio::level)
+                          {
+                            if (!e.removed)
+                              e.on_video (sample);
+                          });
+      }
+
+      for (auto&& e : entries)
+        if (e->removed)
+        {
+          e->audio->clear ();
+          e->g711->clear ();
+          e->video->clear ();
+        }
+      entries.erase (std::remove_if (entries.begin (), entries.end ()
+                                     , [] (std::shared_ptr<entry> const& e) { return e->removed.load (); })
+                     , entries.end ());
+
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        ++rounds;
+      }
+      round_done.notify_all ();
+    }
+
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,115 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_FAILOVER_HPP
+#define RTVC_PIPELINE_FAILOVER_HPP
+
+#include <rtvc/pipeline/source.hpp>
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+namespace rtvc { namespace pipeline {
+
+// Warm standby for one channel: the same channel on the failover NVR,
+// kept PAUSED next to the primary. A live source connects and logs in
+// going to PAUSED but only streams once PLAYING, so the standby costs
+// neither NVR bandwidth nor decoding while the primary is fine, and
+// its own health shows the failover NVR is reachable.
+//
+// When the primary goes down the standby is promoted to PLAYING and
+// its samples take over the channel. The primary takes back once it
+// has been delivering for recover_after, so a flapping NVR doesn't
+// bounce the channel, and the standby is parked in PAUSED again.
+struct failover
+{
+  source* primary;
+  std::unique_ptr<source> standby;
+  gint64 recover_after;
+  std::atomic<bool> on_standby;
+  std::atomic<unsigned int> switches;
+  // Idle source parking the standby again, added from the consuming
+  // thread
+  std::atomic<guint> park_source;
+
+  failover (source& primary, std::unique_ptr<source> standby, guint recover_after = 2000)
+    : primary (&primary), standby (std::move (standby))
+    , recover_after (recover_after * G_GINT64_CONSTANT (1000))
+    , on_standby (false), switches (0), park_source (0)
+  {
+    this->standby->health->keep (GST_STATE_PAUSED);
+  }
+  ~failover ()
+  {
+    if (guint id = park_source.exchange (0))
+      g_source_remove (id);
+  }
+
+  failover (failover const&) = delete;
+  failover& operator=(failover const&) = delete;
+
+  // Whether the standby could take over, it is connected or on its way
+  bool standby_up () const
+  {
+    return standby->health->up ();
+  }
+
+  // On the main loop when the primary goes down
+  void promote ()
+  {
+    if (guint id = park_source.exchange (0))
+      g_source_remove (id);
+    std::cout << "primary down, starting standby" << std::endl;
+    standby->health->keep (GST_STATE_PLAYING);
+  }
+
+  // Called with every sample from either source, on the thread that
+  // consumes them. True if the sample belongs to the live one.
+  bool live (source const& from)
+  {
+    bool from_standby = &from == standby.get ();
+    if (!on_standby)
+    {
+      if (from_standby && !primary->health->up ())
+      {
+        on_standby = true;
+        ++switches;
+      }
+    }
+    else if (!from_standby && primary->health->stable (recover_after))
+    {
+      on_standby = false;
+      ++switches;
+      // One pending is enough, it looks at on_standby when it runs
+      if (!park_source)
+        park_source = g_idle_add (&failover::park_cb, this);
+    }
+    return from_standby == on_standby;
+  }
+
+private:
+  static gboolean park_cb (gpointer user_data)
+  {
+    failover* self = static_cast<failover*>(user_data);
+    self->park_source = 0;
+    if (!self->on_standby)
+    {
+      std::cout << "parking standby" << std::endl;
+      self->standby->health->keep (GST_STATE_PAUSED);
+    }
+    return G_SOURCE_REMOVE;
+  }
+};
+
+} }
+
+#endif
@@ -0,0 +1,208 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_FANOUT_HPP
+#define RTVC_PIPELINE_FANOUT_HPP
+
+#include <rtvc/video/shared_frames.hpp>
+#include <rtvc/pipeline/visualization.hpp>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace rtvc { namespace pipeline {
+
+// Publishes the frames of a channel's tile, decoded and scaled as they
+// go to the compositor, into shared memory for local clients, see
+// rtvc/video/shared_frames.hpp. The frame is copied once into its
+// slot by a probe on the tile, clients read it in place. Publishing
+// never waits, so neither a client nor the lack of one can hold the
+// display back, and only happens while a client polls, so the region
+// is only backed by memory from the first one on.
+struct fanout
+{
+  std::string name;
+  video::shared_frames_header* header;
+  std::size_t size;
+  // Frames too big for a slot, or whose caps aren't video
+  std::atomic<std::uint64_t> skipped;
+  // Streaming thread of the tile only
+  GstCaps* caps;
+  GstVideoInfo info;
+  bool is_video;
+  GstPad* pad;
+  gulong probe;
+
+  // capacity is the most bytes a frame takes, e.g. four per pixel of
+  // the whole window
+  fanout (std::string name, std::size_t capacity, unsigned int slots = 4)
+    : name (std::move (name)), header (nullptr), size (0), skipped (0), caps (nullptr), is_video (false)
+    , pad (nullptr), probe (0)
+  {
+    std::size_t slot_size = (video::shared_frames_block + capacity + 4095) / 4096 * 4096;
+    size = video::shared_frames_size (slots, slot_size);
+    // A region left by an earlier run may still be mapped by readers,
+    // which shrinking it would kill with SIGBUS. It is unlinked
+    // instead, they keep it until they reopen the name, and a fresh
+    // one takes its name.
+    shm_unlink (this->name.c_str ());
+    int fd = shm_open (this->name.c_str (), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+      throw std::runtime_error ("Couldn't create shared frames " + this->name);
+    if (ftruncate (fd, size) < 0)
+    {
+      close (fd);
+      shm_unlink (this->name.c_str ());
+      throw std::runtime_error ("Couldn't size shared frames " + this->name);
+    }
+    void* map = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+    {
+      shm_unlink (this->name.c_str ());
+      throw std::runtime_error ("Couldn't map shared frames " + this->name);
+    }
+    header = static_cast<video::shared_frames_header*>(map);
+    header->slots = slots;
+    header->slot_size = slot_size;
+    header->capacity = slot_size - video::shared_frames_block;
+    header->published.store (0, std::memory_order_relaxed);
+    header->polled.store (0, std::memory_order_relaxed);
+    header->version = video::shared_frames_version;
+    // Last, a reader checks it first
+    std::atomic_thread_fence (std::memory_order_release);
+    header->magic = video::shared_frames_magic;
+    std::cout << "sharing frames as " << this->name << std::endl;
+  }
+  ~fanout ()
+  {
+    detach ();
+    if (caps)
+      gst_caps_unref (caps);
+    munmap (header, size);
+    shm_unlink (name.c_str ());
+  }
+
+  fanout (fanout const&) = delete;
+  fanout& operator=(fanout const&) = delete;
+
+  // Publishes what the tile shows from now on. The probe holds its
+  // own reference, so the fanout outlives a frame in flight.
+  static void attach (std::shared_ptr<fanout> const& self, rtvc::pipeline::tile* tile)
+  {
+    self->detach ();
+    gst_caps_replace (&self->caps, nullptr);
+    self->is_video = false;
+    self->pad = gst_element_get_static_pad (tile->videoflip ? tile->videoflip : tile->scale_capsfilter, "src");
+    self->probe = gst_pad_add_probe (self->pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+                                     , &fanout::publish_cb, new std::shared_ptr<fanout> (self)
+                                     , &fanout::destroy_cb);
+  }
+
+  void detach ()
+  {
+    if (!pad)
+      return;
+    gst_pad_remove_probe (pad, probe);
+    gst_object_unref (pad);
+    pad = nullptr;
+    probe = 0;
+  }
+
+private:
+  static void destroy_cb (gpointer data)
+  {
+    delete static_cast<std::shared_ptr<fanout>*>(data);
+  }
+
+  void set_caps (GstCaps* new_caps)
+  {
+    if (new_caps == caps)
+      return;
+    gst_caps_replace (&caps, new_caps);
+    is_video = caps && gst_video_info_from_caps (&info, caps);
+  }
+
+  static GstPadProbeReturn publish_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    fanout* self = static_cast<std::shared_ptr<fanout>*>(user_data)->get ();
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+      GstEvent* event = GST_PAD_PROBE_INFO_EVENT (info);
+      if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS)
+      {
+        GstCaps* caps;
+        gst_event_parse_caps (event, &caps);
+        self->set_caps (caps);
+      }
+      return GST_PAD_PROBE_OK;
+    }
+
+    // Attached after the caps went by
+    if (!self->caps)
+    {
+      GstCaps* current = gst_pad_get_current_caps (pad);
+      self->set_caps (current);
+      if (current)
+        gst_caps_unref (current);
+    }
+    // Nobody reads, the slots are left untouched
+    std::uint64_t polled = self->header->polled.load (std::memory_order_relaxed);
+    if (!polled || video::shared_frames_now () - polled > video::shared_frames_poll_timeout)
+      return GST_PAD_PROBE_OK;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    if (!self->is_video || gst_buffer_get_size (buffer) > self->header->capacity)
+    {
+      ++self->skipped;
+      return GST_PAD_PROBE_OK;
+    }
+    self->publish (buffer);
+    return GST_PAD_PROBE_OK;
+  }
+
+  void publish (GstBuffer* buffer)
+  {
+    std::uint64_t number = header->published.load (std::memory_order_relaxed);
+    video::shared_frame* frame = video::shared_frame_slot (header, number);
+    frame->sequence.store (2 * number + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    frame->timestamp = GST_BUFFER_TIMESTAMP (buffer);
+    frame->published = g_get_monotonic_time () * GST_USECOND;
+    frame->width = GST_VIDEO_INFO_WIDTH (&info);
+    frame->height = GST_VIDEO_INFO_HEIGHT (&info);
+    std::strncpy (frame->format, gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (&info)), sizeof frame->format - 1);
+    frame->format[sizeof frame->format - 1] = 0;
+    // Upstream may lay planes out its own way
+    GstVideoMeta* meta = gst_buffer_get_video_meta (buffer);
+    frame->planes = std::min (4u, meta ? meta->n_planes : GST_VIDEO_INFO_N_PLANES (&info));
+    for (unsigned int i = 0; i != frame->planes; ++i)
+    {
+      frame->offset[i] = meta ? meta->offset[i] : GST_VIDEO_INFO_PLANE_OFFSET (&info, i);
+      frame->stride[i] = meta ? meta->stride[i] : GST_VIDEO_INFO_PLANE_STRIDE (&info, i);
+    }
+    frame->size = gst_buffer_extract (buffer, 0, reinterpret_cast<std::uint8_t*>(frame) + video::shared_frames_block
+                                      , header->capacity);
+
+    frame->sequence.store (2 * number + 2, std::memory_order_release);
+    header->published.store (number + 1, std::memory_order_release);
+  }
+};
+
+} }
+
+#endif
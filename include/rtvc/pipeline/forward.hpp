@@ -0,0 +1,275 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_FORWARD_HPP
+#define RTVC_PIPELINE_FORWARD_HPP
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+#include <rtvc/metrics/stage.hpp>
+#include <rtvc/pipeline/clock_mapping.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <cassert>
+#include <cstring>
+
+namespace rtvc { namespace pipeline {
+
+// Info structure name for samples replayed from before the live edge,
+// e.g. the cached GOP when video is enabled. Its "live-timestamp"
+// field is the timestamp of the first live buffer that follows.
+constexpr char const* preroll_sample_info = "rtvc-preroll";
+
+// Pushes samples pulled from a source appsink into an appsrc of
+// another pipeline. Buffers are pushed by reference: the rebase to
+// the first timestamp is done with an offset on the appsrc src pad
+// instead of rewriting each buffer, so nothing is copied or allocated
+// per buffer.
+//
+// Following a clock mapping, the offset instead puts every buffer at
+// the running time its source timestamp maps to, so all forwarders of
+// one source share a timeline. Moving the offset sends a new segment,
+// which the mixer hears, so it is only moved again when the mapping is
+// made anew, on a reconnect or a jump. Drift in between is followed by
+// nudging timestamps by at most max_nudge a buffer; those buffers are
+// copies, memory still shared.
+struct forwarder
+{
+  GstElement* appsrc;
+  GstPad* pad;
+  GstCaps* caps;
+  bool started;
+  GstClockTime start_running_time;
+  GstMemory* silence;
+  std::shared_ptr<clock_mapping const> mapping;
+  // Whose base time the mapped offset is relative to
+  GstElement* pipeline;
+  gint64 offset;
+  // Epoch of the mapping the offset was set from, and how far the
+  // timestamps are moved past it
+  unsigned int epoch;
+  gint64 nudge;
+  gint64 max_nudge;
+  // Records every buffer pushed, if set
+  std::shared_ptr<metrics::stage> stage;
+  // Of the source followed
+  metrics::ingress_times const* times;
+
+  forwarder (GstElement* appsrc)
+    : appsrc (appsrc)
+    , pad (gst_element_get_static_pad (appsrc, "src"))
+    , caps (nullptr)
+    , started (false)
+    , start_running_time (0)
+    , silence (nullptr)
+    , pipeline (nullptr)
+    , offset (0)
+    , epoch (0)
+    , nudge (0)
+    , max_nudge (50 * GST_USECOND)
+    , times (nullptr)
+  {
+    if (!pad)
+      throw std::runtime_error ("appsrc has no src pad to forward to");
+  }
+  ~forwarder ()
+  {
+    if (caps)
+      gst_caps_unref (caps);
+    if (pad)
+      gst_object_unref (pad);
+    if (silence)
+      gst_memory_unref (silence);
+  }
+
+  forwarder (forwarder const&) = delete;
+  forwarder& operator=(forwarder const&) = delete;
+  forwarder (forwarder && other)
+    : appsrc (other.appsrc), pad (other.pad), caps (other.caps), started (other.started)
+    , start_running_time (other.start_running_time), silence (other.silence)
+    , mapping (std::move (other.mapping)), pipeline (other.pipeline), offset (other.offset)
+    , epoch (other.epoch), nudge (other.nudge), max_nudge (other.max_nudge), stage (std::move (other.stage)), times (other.times)
+  {
+    other.silence = nullptr;
+    other.appsrc = nullptr;
+    other.pad = nullptr;
+    other.caps = nullptr;
+  }
+
+  // Next buffer pushed is rebased to running_time, zero by default.
+  // A non-zero running time continues an appsrc that is already
+  // playing with buffers from another timeline.
+  void reset (GstClockTime running_time = 0)
+  {
+    started = false;
+    start_running_time = running_time;
+    mapping.reset ();
+  }
+
+  // Next buffers pushed are placed by mapping on the running time of
+  // pipeline, which must run on the monotonic system clock, and
+  // recorded with the ingress times of their stream
+  void follow (std::shared_ptr<clock_mapping const> mapping, GstElement* pipeline
+               , metrics::ingress_times const* times)
+  {
+    started = false;
+    this->mapping = std::move (mapping);
+    this->pipeline = pipeline;
+    this->times = times;
+  }
+
+  GstFlowReturn push (GstSample* sample)
+  {
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    assert (!!buffer);
+    assert (GST_IS_BUFFER (buffer));
+
+    if (stage)
+      stage->record (buffer, times);
+
+    GstCaps* sample_caps = gst_sample_get_caps (sample);
+    if (sample_caps && (!caps || !gst_caps_is_equal (caps, sample_caps)))
+    {
+      gchar* string = gst_caps_to_string (sample_caps);
+      std::cout << "appsrc caps will be " << string << std::endl;
+      g_free (string);
+
+      gst_app_src_set_caps (GST_APP_SRC (appsrc), sample_caps);
+      if (caps)
+        gst_caps_unref (caps);
+      caps = gst_caps_ref (sample_caps);
+    }
+
+    if (!started)
+      return gst_app_src_push_buffer (GST_APP_SRC (appsrc), rebase (sample, buffer));
+    if (mapping)
+      return gst_app_src_push_buffer (GST_APP_SRC (appsrc), remap (sample, gst_buffer_ref (buffer)));
+
+    // appsrc takes the reference, memory stays shared with the sample
+    return gst_app_src_push_buffer (GST_APP_SRC (appsrc), gst_buffer_ref (buffer));
+  }
+
+  // Pushes size bytes of silence in place of the sample, flagged as a
+  // gap so the mixer skips it. A silent input keeps its mixer pad fed
+  // this way: the mixer never has to wait for it to time out, which is
+  // what lets the mix run at a low latency. The silent memory is
+  // allocated once and shared by every gap buffer.
+  GstFlowReturn push_gap (GstSample* sample, gsize size)
+  {
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    assert (!!buffer);
+    if (!size)
+      return GST_FLOW_OK;
+    if (!silence || gst_memory_get_sizes (silence, nullptr, nullptr) < size)
+    {
+      if (silence)
+        gst_memory_unref (silence);
+      silence = gst_allocator_alloc (nullptr, size, nullptr);
+      GstMapInfo map;
+      gst_memory_map (silence, &map, GST_MAP_WRITE);
+      std::memset (map.data, 0, map.size);
+      gst_memory_unmap (silence, &map);
+    }
+
+    GstBuffer* gap = gst_buffer_new ();
+    gst_buffer_append_memory (gap, gst_memory_share (silence, 0, size));
+    gst_buffer_copy_into (gap, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+    GST_BUFFER_FLAG_SET (gap, GST_BUFFER_FLAG_GAP);
+    GST_BUFFER_FLAG_SET (gap, GST_BUFFER_FLAG_DROPPABLE);
+    if (started && mapping)
+      gap = remap (sample, gap);
+    if (!started)
+    {
+      GstBuffer* first = rebase (sample, gap);
+      gst_buffer_unref (gap);
+      gap = first;
+    }
+    return gst_app_src_push_buffer (GST_APP_SRC (appsrc), gap);
+  }
+
+private:
+  // Sets the offset from the first buffer of a new timeline and
+  // returns a new reference to it marked as a discontinuity
+  GstBuffer* rebase (GstSample* sample, GstBuffer* buffer)
+  {
+    if (mapping)
+    {
+      // Preroll samples map to the past and are late, so they are
+      // decoded but never displayed
+      offset = mapped_offset ();
+      epoch = mapping->epoch;
+      nudge = 0;
+      gst_pad_set_offset (pad, offset);
+      started = true;
+      GstBuffer* first = gst_buffer_copy (buffer);
+      GST_BUFFER_FLAG_SET (first, GST_BUFFER_FLAG_DISCONT);
+      return first;
+    }
+
+    // Preroll samples start at the live edge, so the history before
+    // it falls outside the segment: decoded, but never displayed late
+    GstClockTime base = GST_BUFFER_TIMESTAMP (buffer);
+    GstStructure const* info = gst_sample_get_info (sample);
+    guint64 live = 0;
+    if (info && gst_structure_has_name (info, preroll_sample_info)
+        && gst_structure_get_uint64 (info, "live-timestamp", &live))
+      base = live;
+    gst_pad_set_offset (pad, static_cast<gint64>(start_running_time) - static_cast<gint64>(base));
+    started = true;
+
+    // Whatever was pushed before came from another timeline. The copy
+    // only carries the flag, memory is still shared.
+    GstBuffer* first = gst_buffer_copy (buffer);
+    GST_BUFFER_FLAG_SET (first, GST_BUFFER_FLAG_DISCONT);
+    return first;
+  }
+
+  gint64 mapped_offset () const
+  {
+    return mapping->offset - static_cast<gint64> (gst_element_get_base_time (pipeline));
+  }
+
+  // Takes buffer and returns what to push in its place: the buffer
+  // itself, a copy nudged towards the mapping, or the first of a new
+  // timeline when the mapping was made anew
+  GstBuffer* remap (GstSample* sample, GstBuffer* buffer)
+  {
+    if (mapping->epoch != epoch)
+    {
+      started = false;
+      GstBuffer* first = rebase (sample, buffer);
+      gst_buffer_unref (buffer);
+      return first;
+    }
+    gint64 target = mapped_offset () - offset;
+    nudge += std::max (-max_nudge, std::min (max_nudge, target - nudge));
+    if (!nudge)
+      return buffer;
+    GstBuffer* nudged = gst_buffer_copy (buffer);
+    gst_buffer_unref (buffer);
+    if (GST_BUFFER_PTS_IS_VALID (nudged))
+      GST_BUFFER_PTS (nudged) = nudged_time (GST_BUFFER_PTS (nudged));
+    if (GST_BUFFER_DTS_IS_VALID (nudged))
+      GST_BUFFER_DTS (nudged) = nudged_time (GST_BUFFER_DTS (nudged));
+    return nudged;
+  }
+
+  GstClockTime nudged_time (GstClockTime time) const
+  {
+    return nudge < 0 && static_cast<GstClockTime> (-nudge) > time ? 0 : time + nudge;
+  }
+};
+
+} }
+
+#endif
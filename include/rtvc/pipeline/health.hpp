@@ -0,0 +1,191 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_HEALTH_HPP
+#define RTVC_PIPELINE_HEALTH_HPP
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+
+namespace rtvc { namespace pipeline {
+
+// Restarts one source pipeline after errors, with exponential backoff
+// and jitter so a whole NVR coming back isn't hammered by every
+// channel at once. Only that pipeline is touched.
+//
+// A source that stops delivering without an error, e.g. a stalled
+// TCP connection, is failed by a watchdog after stall_timeout instead
+// of waiting for the dmsssrc timeout. Any demuxed buffer counts, audio
+// or video. A restart logs in again, so the timeout is seconds unless
+// a standby can take over meanwhile, see quick_stall.
+//
+// failed, the retry and the watchdog run on the GLib main loop,
+// delivered on the streaming thread.
+struct health
+{
+  GstElement* pipeline;
+  // State the pipeline is kept in, PAUSED for a warm standby that is
+  // only connected. Only a playing source is watched for stalls.
+  GstState target;
+  // Called on the main loop when the source goes down
+  std::function<void ()> on_down;
+  guint min_delay, max_delay;
+  gint64 stall_timeout;
+  // Floor of the timeout derived from the gaps between buffers, zero
+  // to always wait stall_timeout
+  gint64 quick_stall_timeout;
+  guint timer, watchdog;
+  std::atomic<unsigned int> attempt;
+  // Bumped on every restart, data after a change is a new connection
+  std::atomic<unsigned int> connection;
+  std::atomic<unsigned int> reconnects;
+  // Monotonic time the source went down, zero while up
+  std::atomic<gint64> down_since;
+  // Total time spent down, in microseconds
+  std::atomic<gint64> downtime;
+  // Monotonic times of the last buffer and of the first buffer of the
+  // current connection, zero before any
+  std::atomic<gint64> last_delivery;
+  std::atomic<gint64> up_since;
+  // Longest time between buffers of the current connection
+  std::atomic<gint64> max_gap;
+
+  health (GstElement* pipeline, guint min_delay = 500, guint max_delay = 30000
+          , guint stall_timeout = 5000)
+    : pipeline (pipeline), target (GST_STATE_PLAYING), min_delay (min_delay), max_delay (max_delay)
+    , stall_timeout (stall_timeout * G_GINT64_CONSTANT (1000)), quick_stall_timeout (0), timer (0)
+    , attempt (0), connection (0), reconnects (0), down_since (0), downtime (0)
+    , last_delivery (0), up_since (0), max_gap (0)
+  {
+    watchdog = g_timeout_add (100, &health::watchdog_cb, this);
+  }
+  ~health ()
+  {
+    if (timer)
+      g_source_remove (timer);
+    g_source_remove (watchdog);
+  }
+
+  health (health const&) = delete;
+  health& operator=(health const&) = delete;
+
+  void failed ()
+  {
+    if (timer)
+      return;
+
+    gint64 up = 0;
+    if (down_since.compare_exchange_strong (up, g_get_monotonic_time ()) && on_down)
+      on_down ();
+    up_since = 0;
+    last_delivery = 0;
+    max_gap = 0;
+
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+
+    unsigned int n = attempt++;
+    guint delay = n < 16 ? std::min<guint> (max_delay, min_delay << n) : max_delay;
+    delay = delay / 2 + g_random_int_range (0, delay);
+    std::cout << "source down, retrying in " << delay << "ms (attempt " << n + 1 << ")" << std::endl;
+    timer = g_timeout_add (delay, &health::retry_cb, this);
+  }
+
+  void delivered ()
+  {
+    gint64 now = g_get_monotonic_time ();
+    gint64 previous = last_delivery.exchange (now);
+    // Only ever grows, a lost race loses a gap of about the same size
+    if (previous && now - previous > max_gap)
+      max_gap = now - previous;
+    if (!up_since)
+      up_since = now;
+    gint64 since = down_since.load ();
+    if (since && down_since.compare_exchange_strong (since, 0))
+    {
+      gint64 down = now - since;
+      downtime += down;
+      ++reconnects;
+      attempt = 0;
+    }
+  }
+
+  // On the main loop, brings the pipeline to state and keeps it there
+  // across restarts. Deliveries are forgotten, a paused source is not
+  // stalled.
+  void keep (GstState state)
+  {
+    target = state;
+    last_delivery = 0;
+    up_since = 0;
+    max_gap = 0;
+    if (!timer)
+      gst_element_set_state (pipeline, state);
+  }
+
+  // On the main loop, while a standby can take over. A stall is then
+  // four times the longest gap between buffers seen on the connection,
+  // so a low frame rate substream without audio doesn't flap, at least
+  // floor and at most stall_timeout.
+  void quick_stall (guint floor)
+  {
+    quick_stall_timeout = floor * G_GINT64_CONSTANT (1000);
+  }
+
+  // What a stall is now
+  gint64 stall_after () const
+  {
+    gint64 gap = max_gap.load ();
+    if (!quick_stall_timeout || !gap)
+      return stall_timeout;
+    return std::min (stall_timeout, std::max (quick_stall_timeout, 4 * gap));
+  }
+
+  bool up () const
+  {
+    return !down_since;
+  }
+
+  // Up and delivering for at least the given time, in microseconds
+  bool stable (gint64 time) const
+  {
+    gint64 since = up_since.load ();
+    return up () && since && g_get_monotonic_time () - since >= time;
+  }
+
+private:
+  static gboolean retry_cb (gpointer user_data)
+  {
+    health* self = static_cast<health*>(user_data);
+    self->timer = 0;
+    ++self->connection;
+    gst_element_set_state (self->pipeline, self->target);
+    return G_SOURCE_REMOVE;
+  }
+
+  static gboolean watchdog_cb (gpointer user_data)
+  {
+    health* self = static_cast<health*>(user_data);
+    gint64 last = self->last_delivery.load ();
+    if (!self->timer && self->up () && last && self->target == GST_STATE_PLAYING
+        && g_get_monotonic_time () - last > self->stall_after ())
+    {
+      std::cout << "source stalled for " << (g_get_monotonic_time () - last) / 1000 << "ms" << std::endl;
+      self->failed ();
+    }
+    return G_SOURCE_CONTINUE;
+  }
+};
+
+} }
+
+#endif
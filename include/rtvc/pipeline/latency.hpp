@@ -0,0 +1,145 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_LATENCY_HPP
+#define RTVC_PIPELINE_LATENCY_HPP
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace rtvc { namespace pipeline {
+
+// How late the audio of one source reaches the dispatcher past where
+// its clock mapping puts it: network and NVR jitter plus the time in
+// the source pipeline. Kept for the last window buffers, added and
+// read on the dispatcher thread; the counters are read by metrics.
+struct jitter
+{
+  std::vector<gint64> window;
+  std::size_t next, count;
+  // Buffers later than the mixer waits for, so not heard
+  std::atomic<guint64> underruns;
+  // Percentile of the window at the last update, in nanoseconds
+  std::atomic<gint64> percentile;
+
+  // About 30 s of 20 ms audio buffers
+  jitter (std::size_t size = 1500)
+    : window (size), next (0), count (0), underruns (0), percentile (0)
+  {}
+
+  jitter (jitter const&) = delete;
+  jitter& operator=(jitter const&) = delete;
+
+  void add (gint64 lateness, GstClockTime wait)
+  {
+    window[next] = lateness;
+    next = (next + 1) % window.size ();
+    count = std::min (count + 1, window.size ());
+    if (lateness > static_cast<gint64> (wait))
+      ++underruns;
+  }
+
+  gint64 measure (double p, std::vector<gint64>& scratch)
+  {
+    if (!count)
+      return 0;
+    scratch.assign (window.begin (), window.begin () + count);
+    std::size_t n = std::min (count - 1, static_cast<std::size_t> (p * count));
+    std::nth_element (scratch.begin (), scratch.begin () + n, scratch.end ());
+    percentile = scratch[n];
+    return scratch[n];
+  }
+};
+
+// Sizes the wait for late audio to the percentile of the lateness of
+// every source, plus a margin. A longer wait is taken at once, a
+// shorter one only after it was enough for hold, so the latency does
+// not flap: every change of pipeline latency is a short glitch.
+//
+// Jitters are added and removed on the main loop, update runs on the
+// dispatcher thread.
+struct latency_controller
+{
+  double target;
+  GstClockTime margin, minimum, maximum;
+  gint64 interval, hold;
+  std::mutex mutex;
+  std::vector<std::shared_ptr<jitter>> jitters;
+  // Wait currently applied, for metrics
+  std::atomic<GstClockTime> wait;
+  gint64 last_update, shorter_since;
+  std::vector<gint64> scratch;
+
+  latency_controller (GstClockTime wait)
+    : target (0.99), margin (10 * GST_MSECOND), minimum (20 * GST_MSECOND), maximum (GST_SECOND / 2)
+    , interval (1000000), hold (10000000), wait (wait), last_update (0), shorter_since (0)
+  {}
+
+  latency_controller (latency_controller const&) = delete;
+  latency_controller& operator=(latency_controller const&) = delete;
+
+  void add (std::shared_ptr<jitter> j)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    jitters.push_back (std::move (j));
+  }
+  void remove (std::shared_ptr<jitter> const& j)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    jitters.erase (std::remove (jitters.begin (), jitters.end (), j), jitters.end ());
+  }
+
+  // Calls apply with a new wait when it should change, at most once
+  // an interval
+  template <typename F>
+  void update (gint64 now, F apply)
+  {
+    if (now - last_update < interval)
+      return;
+    last_update = now;
+
+    gint64 worst = 0;
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      for (auto&& j : jitters)
+        worst = std::max (worst, j->measure (target, scratch));
+    }
+    GstClockTime wanted = std::max (minimum, std::min (maximum, static_cast<GstClockTime> (worst) + margin));
+    GstClockTime current = wait;
+    if (wanted > current)
+    {
+      shorter_since = 0;
+      wait = wanted;
+      apply (wanted);
+    }
+    // Within a margin is close enough
+    else if (wanted + margin < current)
+    {
+      if (!shorter_since)
+        shorter_since = now;
+      else if (now - shorter_since >= hold)
+      {
+        shorter_since = 0;
+        wait = wanted;
+        apply (wanted);
+      }
+    }
+    else
+      shorter_since = 0;
+  }
+};
+
+} }
+
+#endif
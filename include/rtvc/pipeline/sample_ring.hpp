@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_SAMPLE_RING_HPP
+#define RTVC_PIPELINE_SAMPLE_RING_HPP
+
+#include <rtvc/audio/level.hpp>
+
+#include <gst/gst.h>
+
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace rtvc { namespace pipeline {
+
+// Wakes the thread draining a set of rings. Producers only take the
+// lock when the consumer may be asleep, once per batch.
+struct wakeup
+{
+  std::atomic<bool> pending;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  wakeup () : pending (false) {}
+
+  void notify ()
+  {
+    if (!pending.exchange (true))
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      condition.notify_one ();
+    }
+  }
+
+  // Returns false if stop became true instead
+  template <typename F>
+  bool wait (F stop)
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    condition.wait (lock, [&] { return pending.load () || stop (); });
+    if (stop ())
+      return false;
+    pending.exchange (false);
+    return true;
+  }
+
+  void interrupt ()
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    condition.notify_one ();
+  }
+};
+
+// Single producer, single consumer ring of samples from one appsink.
+// The producer is the streaming thread and never blocks: when the
+// ring is full, or nobody drains it, the sample is dropped.
+struct sample_ring
+{
+  struct item
+  {
+    GstSample* sample;
+    audio::level level;
+  };
+
+  boost::lockfree::spsc_queue<item> queue;
+  std::atomic<wakeup*> target;
+  std::atomic<std::uint64_t> dropped;
+
+  sample_ring (std::size_t capacity)
+    : queue (capacity), target (nullptr), dropped (0)
+  {}
+  ~sample_ring ()
+  {
+    clear ();
+  }
+
+  sample_ring (sample_ring const&) = delete;
+  sample_ring& operator=(sample_ring const&) = delete;
+
+  // Takes the sample reference
+  bool push (GstSample* sample, audio::level level = audio::level{})
+  {
+    wakeup* w = target.load ();
+    if (!w || !queue.push (item{sample, level}))
+    {
+      gst_sample_unref (sample);
+      ++dropped;
+      return false;
+    }
+    w->notify ();
+    return true;
+  }
+
+  // Calls f for every queued item; the reference is released after
+  template <typename F>
+  void drain (F f)
+  {
+    queue.consume_all ([&] (item const& i)
+                       {
+                         f (i.sample, i.level);
+                         gst_sample_unref (i.sample);
+                       });
+  }
+
+  void clear ()
+  {
+    queue.consume_all ([] (item const& i) { gst_sample_unref (i.sample); });
+  }
+};
+
+} }
+
+#endif
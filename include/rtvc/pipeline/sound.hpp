@@ -10,81 +10,417 @@
 #ifndef RTVC_PIPELINE_SOUND_HPP
 #define RTVC_PIPELINE_SOUND_HPP
 
+#include <rtvc/audio/mix.hpp>
+
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 
+#include <atomic>
 #include <string>
 #include <stdexcept>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cassert>
 
 namespace rtvc { namespace pipeline {
 
+// audiomixer ! capsfilter ! audioconvert ! audioresample !
+// autoaudiosink with one appsrc ! audioresample input per source.
+// Every input is in RTVC_AUDIO_INPUT_CAPS already, at the rate of its
+// stream. The mix is F32 at the highest rate of the inputs linked, see
+// audio::mix_caps: the resampler of an input at that rate passes it
+// through, its mixer pad only converts it to float, and the mix is
+// converted for the sink. The rate is looked at again every 50 ms, a
+// new one renegotiates the mix.
+//
+// Inputs are added and removed while the mixer is playing: each only
+// requests or releases its own mixer pad, the pipeline itself never
+// changes state, so one source coming or going doesn't glitch the others.
+//
+// Each input has a priority and a gain. Its mixer pad volume is the
+// gain; the ducking, evaluated as buffers are fed and every 50 ms, is
+// ramped sample by sample into its buffers before the mixer, so it
+// never steps. The float mix goes through a limiter before it is
+// converted, so loud inputs together never clip.
 struct sound_sink
 {
+  // Ducking gain of one input, ramped on its streaming thread towards
+  // the target the ducking last set
+  struct ramp
+  {
+    std::atomic<float> target;
+    float applied;
+
+    ramp () : target (1.f), applied (1.f) {}
+  };
+
+  // Indexed by input, null for a removed input whose slot is free
   std::vector<GstElement*> appsrc;
-  std::vector<GstElement*> audioconvert;
+  std::vector<GstElement*> resamplers;
+  std::vector<GstPad*> mixer_pads;
+  std::vector<float> gains;
+  // Owned by the probe on the appsrc pad
+  std::vector<ramp*> ramps;
   GstElement *audiomixer;
+  GstElement *mix_capsfilter;
+  GstElement *audioconvert;
+  GstElement *audioresample;
   GstElement *sink;
   GstElement *pipeline;
+  unsigned int created;
+  // Of the mix, set on the main loop and read by the limiter
+  std::atomic<unsigned int> rate;
+  audio::ducking ducking;
+  // Only touched on the mixer streaming thread
+  audio::limiter limiter;
+  std::mutex mutex;
+  guint timer;
 
-  sound_sink (int sources)
+  // sink_factory replaces autoaudiosink, e.g. with a fakesink to run
+  // without a sound card
+  sound_sink (char const* sink_factory = "autoaudiosink")
     : audiomixer (gst_element_factory_make ("audiomixer", "audiomixer"))
-    , sink (gst_element_factory_make ("autoaudiosink", "autoaudiosink"))
+    , mix_capsfilter (gst_element_factory_make ("capsfilter", "mix_capsfilter"))
+    , audioconvert (gst_element_factory_make ("audioconvert", "audioconvert"))
+    , audioresample (gst_element_factory_make ("audioresample", "audioresample"))
+    , sink (gst_element_factory_make (sink_factory, "autoaudiosink"))
     , pipeline (gst_pipeline_new ("sink_pipeline"))
+    , created (0)
+    , rate (audio::g711_rate)
   {
-    appsrc.resize(sources);
-    audioconvert.resize(sources);
     if (!audiomixer)
       throw std::runtime_error ("Couldn't create audiomixer plugin");
+    if (!mix_capsfilter || !audioconvert || !audioresample)
+      throw std::runtime_error ("Couldn't create sound sink conversion plugins");
     if (!sink)
-      throw std::runtime_error ("Couldn't create autoaudiosink plugin");
+      throw std::runtime_error (std::string ("Couldn't create ") + sink_factory + " plugin");
     if (!pipeline)
       throw std::runtime_error ("Couldn't create pipeline");
-    gst_bin_add_many (GST_BIN (pipeline), audiomixer, sink, NULL);
+    // Not the audio device's clock: sources are mapped to this one,
+    // and the sink follows it by resampling. The default, skew, would
+    // make it skip or repeat samples every time the device drifts past
+    // the tolerance, which is heard.
+    GstClock* clock = gst_system_clock_obtain ();
+    gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
+    gst_object_unref (clock);
+    resample_clock (sink);
+    // The device sink autoaudiosink picks
+    g_signal_connect (pipeline, "deep-element-added", G_CALLBACK (&sound_sink::element_added), nullptr);
+    GstCaps* mix_caps = audio::mix_caps (rate);
+    g_object_set (G_OBJECT (mix_capsfilter), "caps", mix_caps, NULL);
+    gst_caps_unref (mix_caps);
+    gst_bin_add_many (GST_BIN (pipeline), audiomixer, mix_capsfilter, audioconvert, audioresample, sink, NULL);
 
+    if (gst_element_link_many (audiomixer, mix_capsfilter, audioconvert, audioresample, sink, NULL) != TRUE)
     {
-      unsigned int i = 0;
-      for (auto&& src : appsrc)
+      throw std::runtime_error ("Elements could not be linked.\n");
+    }    
+
+    GstPad* pad = gst_element_get_static_pad (mix_capsfilter, "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, &sound_sink::limit_cb, this, nullptr);
+    gst_object_unref (pad);
+    // So an input that stopped being fed is let go of after hold, and
+    // the mix follows the rates of its inputs
+    timer = g_timeout_add (50, &sound_sink::duck_cb, this);
+  }
+  ~sound_sink ()
+  {
+    g_source_remove (timer);
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    for (auto&& pad : mixer_pads)
+      if (pad)
       {
-        std::string name = "appsrc";
-        name += std::to_string(++i);
-        src = gst_element_factory_make ("appsrc", name.c_str());
-        if (!src)
-          throw std::runtime_error ("Not all elements could be created in visualization.");
-        g_object_set (G_OBJECT (src), "format", GST_FORMAT_TIME, NULL);
-        g_object_set (G_OBJECT (src), "is-live", TRUE, NULL);
-        gst_app_src_set_stream_type(GST_APP_SRC(src), GST_APP_STREAM_TYPE_STREAM);
-        gst_bin_add (GST_BIN (pipeline), src);
+        gst_element_release_request_pad (audiomixer, pad);
+        gst_object_unref (pad);
       }
+    gst_object_unref (pipeline);
+  }
+
+  // Adds an input and returns its index. The branch joins whatever
+  // state the pipeline is in.
+  unsigned int add ()
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    ++created;
+    GstElement* src = gst_element_factory_make ("appsrc", ("appsrc" + std::to_string (created)).c_str());
+    GstElement* resample = gst_element_factory_make ("audioresample", ("input_resample" + std::to_string (created)).c_str());
+    if (!src || !resample)
+      throw std::runtime_error ("Not all elements could be created in sound sink.");
+    // Until the forwarder sets the caps of what it is fed
+    GstCaps* input_caps = gst_caps_from_string (RTVC_AUDIO_INPUT_CAPS);
+    gst_caps_set_simple (input_caps, "rate", G_TYPE_INT, static_cast<gint> (audio::g711_rate), NULL);
+    g_object_set (G_OBJECT (src), "format", GST_FORMAT_TIME, "caps", input_caps, NULL);
+    gst_caps_unref (input_caps);
+    g_object_set (G_OBJECT (src), "is-live", TRUE, NULL);
+    gst_app_src_set_stream_type(GST_APP_SRC(src), GST_APP_STREAM_TYPE_STREAM);
+    ramp* r = new ramp;
+    {
+      GstPad* pad = gst_element_get_static_pad (src, "src");
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, &sound_sink::ramp_cb, r
+                         , [] (gpointer user_data) { delete static_cast<ramp*>(user_data); });
+      gst_object_unref (pad);
+    }
+    gst_bin_add_many (GST_BIN (pipeline), src, resample, NULL);
+    gst_element_link (src, resample);
+
+    auto it = std::find (appsrc.begin (), appsrc.end (), nullptr);
+    unsigned int index = it - appsrc.begin ();
+    if (it == appsrc.end ())
+    {
+      appsrc.push_back (nullptr);
+      resamplers.push_back (nullptr);
+      mixer_pads.push_back (nullptr);
+      gains.push_back (1.f);
+      ramps.push_back (nullptr);
+    }
+    appsrc[index] = src;
+    resamplers[index] = resample;
+    gains[index] = 1.f;
+    ramps[index] = r;
+    ducking.resize (appsrc.size ());
+    ducking.inputs[index] = audio::ducking::input ();
+    std::cout << "adding source " << index << " to the mix" << std::endl;
+    link (index);
+    return index;
+  }
+
+  // Takes the input out for good, its slot may be reused by add
+  void remove (unsigned int index)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    if (index >= appsrc.size () || !appsrc[index])
+      return;
+    std::cout << "removing source " << index << " from the mix" << std::endl;
+    unlink (index);
+    gst_element_set_state (appsrc[index], GST_STATE_NULL);
+    gst_element_set_state (resamplers[index], GST_STATE_NULL);
+    // Freed with the appsrc
+    ramps[index] = nullptr;
+    gst_bin_remove_many (GST_BIN (pipeline), appsrc[index], resamplers[index], NULL);
+    appsrc[index] = nullptr;
+    resamplers[index] = nullptr;
+    ducking.inputs[index] = audio::ducking::input ();
+  }
+
+  // Higher is more important, inputs start at 0
+  void priority (unsigned int index, int priority)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    ducking.inputs[index].priority = priority;
+    duck ();
+  }
+
+  // Volume of the input, before ducking, 1 leaves it as is
+  void gain (unsigned int index, float gain)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    gains[index] = gain;
+    if (mixer_pads[index])
+      g_object_set (G_OBJECT (mixer_pads[index]), "volume", volume (index), NULL);
+  }
+
+  // Tells the ducking a buffer of this level was pushed to the input
+  void feed (unsigned int index, audio::level level)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    audio::ducking::input& input = ducking.inputs[index];
+    input.last_active = g_get_monotonic_time ();
+    input.level = level.rms;
+    duck ();
+  }
+
+  sound_sink (sound_sink const&) = delete;
+  sound_sink& operator=(sound_sink const&) = delete;
+
+  // Takes a source out of the mix while it is down. Its branch is
+  // stopped and its mixer pad released, so the mixer doesn't wait
+  // for it and the other sources play on untouched.
+  void deactivate (unsigned int index)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    if (!mixer_pads[index])
+      return;
+    std::cout << "source " << index << " out of the mix while down" << std::endl;
+    unlink (index);
+  }
+
+  // Brings a source back into the running mix
+  void activate (unsigned int index)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    if (mixer_pads[index])
+      return;
+    std::cout << "source " << index << " back in the mix" << std::endl;
+    link (index);
+  }
+
+  // End to end latency of the mix. The mixer waits half of it for
+  // an input that is late before mixing without it, the other half is
+  // left to convert and play the mix. Inputs push gaps while silent,
+  // so the wait only ever runs out for a source that really is late.
+  void latency (GstClockTime latency)
+  {
+    g_object_set (G_OBJECT (audiomixer), "latency", static_cast<guint64> (wait (latency)), NULL);
+    gst_pipeline_set_latency (GST_PIPELINE (pipeline), latency);
+  }
+
+  static GstClockTime wait (GstClockTime latency)
+  {
+    return latency / 2;
+  }
+  // The latency that makes the mixer wait that long
+  static GstClockTime latency_for_wait (GstClockTime wait)
+  {
+    return wait * 2;
+  }
+
+  GstClockTime running_time () const
+  {
+    GstClock* clock = gst_element_get_clock (pipeline);
+    if (!clock)
+      return 0;
+    GstClockTime now = gst_clock_get_time (clock) - gst_element_get_base_time (pipeline);
+    gst_object_unref (clock);
+    return now;
+  }
+
+private:
+  // With the lock held
+  gdouble volume (unsigned int index) const
+  {
+    return gains[index];
+  }
+
+  void duck ()
+  {
+    ducking.update (g_get_monotonic_time (), [this] (std::size_t index, float gain)
+                    {
+                      if (ramps[index])
+                        ramps[index]->target.store (gain, std::memory_order_relaxed);
+                    });
+  }
+
+  static void resample_clock (GstElement* element)
+  {
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "slave-method"))
+      gst_util_set_object_arg (G_OBJECT (element), "slave-method", "resample");
+  }
 
-      i = 0;
-      for (auto&& source : appsrc)
+  static void element_added (GstBin* bin, GstBin* sub_bin, GstElement* element, gpointer user_data)
+  {
+    resample_clock (element);
+  }
+
+  static gboolean duck_cb (gpointer user_data)
+  {
+    sound_sink* self = static_cast<sound_sink*>(user_data);
+    std::lock_guard<std::mutex> lock (self->mutex);
+    self->duck ();
+    self->follow_rates ();
+    return G_SOURCE_CONTINUE;
+  }
+
+  // With the lock held, on the main loop. The highest rate of the
+  // inputs in the mix, the G.711 one without any.
+  void follow_rates ()
+  {
+    unsigned int highest = audio::g711_rate;
+    for (std::size_t index = 0; index != appsrc.size (); ++index)
+    {
+      if (!mixer_pads[index])
+        continue;
+      GstPad* pad = gst_element_get_static_pad (appsrc[index], "src");
+      GstCaps* caps = gst_pad_get_current_caps (pad);
+      gst_object_unref (pad);
+      gint input_rate = 0;
+      if (caps)
       {
-        std::cout << "creating audioconvert elements" << std::endl;
-        std::string name = "audioconvert";
-        name += std::to_string(i);
-        GstElement* convert = gst_element_factory_make ("audioconvert", name.c_str());
-        if (!convert)
-          throw std::runtime_error ("Not all elements could be created in visualization.");
-        std::cout << "created" << std::endl;
-        gst_bin_add (GST_BIN (pipeline), convert);
-        gst_element_link (source, convert);
-        auto src_pad = gst_element_get_static_pad (convert, "src");
-        assert (!!src_pad);
-        auto sink_pad = gst_element_get_request_pad (audiomixer, "sink_%u");
-        assert (!!sink_pad);
-
-        std::cout << "pad name: " << gst_pad_get_name (sink_pad) << std::endl;
-        gst_pad_link (src_pad, sink_pad);
-
-        ++i;
+        gst_structure_get_int (gst_caps_get_structure (caps, 0), "rate", &input_rate);
+        gst_caps_unref (caps);
       }
+      highest = std::max (highest, static_cast<unsigned int> (std::max (0, input_rate)));
     }
-    
-    if (gst_element_link_many (audiomixer, sink, NULL) != TRUE)
+    if (highest == rate)
+      return;
+    std::cout << "mixing at " << highest << " Hz" << std::endl;
+    rate = highest;
+    GstCaps* caps = audio::mix_caps (highest);
+    g_object_set (G_OBJECT (mix_capsfilter), "caps", caps, NULL);
+    gst_caps_unref (caps);
+  }
+
+  // Ramps each buffer from the gain the last one ended at to the
+  // target. Gaps are silent, the gain just jumps over them.
+  static GstPadProbeReturn ramp_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    ramp* self = static_cast<ramp*>(user_data);
+    float target = self->target.load (std::memory_order_relaxed);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_GAP))
     {
-      throw std::runtime_error ("Elements could not be linked.\n");
-    }    
-    
+      self->applied = target;
+      return GST_PAD_PROBE_OK;
+    }
+    if (target == 1.f && self->applied == 1.f)
+      return GST_PAD_PROBE_OK;
+    buffer = gst_buffer_make_writable (buffer);
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    GstMapInfo map;
+    if (gst_buffer_map (buffer, &map, GST_MAP_READWRITE))
+    {
+      audio::ramp_s16 (reinterpret_cast<std::int16_t*>(map.data), map.size / sizeof(std::int16_t)
+                       , self->applied, target);
+      gst_buffer_unmap (buffer, &map);
+    }
+    self->applied = target;
+    return GST_PAD_PROBE_OK;
+  }
+
+  void link (unsigned int index)
+  {
+    auto sink_pad = gst_element_get_request_pad (audiomixer, "sink_%u");
+    assert (!!sink_pad);
+    g_object_set (G_OBJECT (sink_pad), "volume", volume (index), NULL);
+    auto src_pad = gst_element_get_static_pad (resamplers[index], "src");
+    gst_pad_link (src_pad, sink_pad);
+    gst_object_unref (src_pad);
+    mixer_pads[index] = sink_pad;
+    gst_element_set_locked_state (resamplers[index], FALSE);
+    gst_element_set_locked_state (appsrc[index], FALSE);
+    gst_element_sync_state_with_parent (resamplers[index]);
+    gst_element_sync_state_with_parent (appsrc[index]);
+  }
+
+  void unlink (unsigned int index)
+  {
+    if (!mixer_pads[index])
+      return;
+    gst_element_set_locked_state (appsrc[index], TRUE);
+    gst_element_set_locked_state (resamplers[index], TRUE);
+    gst_element_set_state (appsrc[index], GST_STATE_READY);
+    gst_element_set_state (resamplers[index], GST_STATE_READY);
+    auto src_pad = gst_element_get_static_pad (resamplers[index], "src");
+    gst_pad_unlink (src_pad, mixer_pads[index]);
+    gst_object_unref (src_pad);
+    gst_element_release_request_pad (audiomixer, mixer_pads[index]);
+    gst_object_unref (mixer_pads[index]);
+    mixer_pads[index] = nullptr;
+  }
+
+  static GstPadProbeReturn limit_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    sound_sink* self = static_cast<sound_sink*>(user_data);
+    GstBuffer* buffer = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    GstMapInfo map;
+    if (gst_buffer_map (buffer, &map, GST_MAP_READWRITE))
+    {
+      self->limiter.process (reinterpret_cast<float*>(map.data), map.size / sizeof(float), self->rate);
+      gst_buffer_unmap (buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
   }
 };
     
@@ -12,12 +12,27 @@
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
+#include <gst/audio/audio.h>
+
+#include <rtvc/audio/level.hpp>
+#include <rtvc/audio/g711.hpp>
+#include <rtvc/audio/mix.hpp>
+#include <rtvc/pipeline/video_gate.hpp>
+#include <rtvc/pipeline/forward.hpp>
+#include <rtvc/pipeline/clock_mapping.hpp>
+#include <rtvc/pipeline/latency.hpp>
+#include <rtvc/pipeline/sample_ring.hpp>
+#include <rtvc/pipeline/health.hpp>
+#include <rtvc/metrics/stage.hpp>
+#include <rtvc/capture/tap.hpp>
+#include <rtvc/capture/player.hpp>
 
 #include <string>
 #include <stdexcept>
 #include <iostream>
-
-#include <boost/signals2.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 namespace rtvc { namespace pipeline {
 
@@ -31,124 +46,118 @@ struct source
   GstElement *audioresample;
   GstElement *appsink;
   GstElement *audio_queue1, *audio_queue2;
-  GstElement *rganalysis;
   GstElement *video_queue;
   GstElement *video_appsink;
   GstElement *pipeline;
-  double current_level;
+  std::unique_ptr<video_gate> video;
+  std::unique_ptr<rtvc::pipeline::health> health;
+  std::atomic<double> current_level;
+  GstCaps* audio_caps;
+  GstAudioFormat audio_format;
   gulong bus_connection;
-  boost::signals2::signal <void (GstSample*)> sample_signal;  
-  boost::signals2::signal <void (GstSample*)> sample_video_signal;  
+  // Samples pulled by the appsinks, drained by a dispatcher
+  std::shared_ptr<sample_ring> audio_ring;
+  std::shared_ptr<sample_ring> video_ring;
+  // Undecoded G.711 samples, pushed from the thread feeding the audio
+  // queue rather than the appsink's, so a ring of their own: both may
+  // push while the caps change
+  std::shared_ptr<sample_ring> g711_ring;
+  // host:port/channel.subchannel, or the capture replayed, to tell
+  // sources apart in metrics
+  std::string name;
+  std::shared_ptr<metrics::source_stages> stages;
+  // Timestamps of both media to the monotonic clock
+  std::shared_ptr<clock_mapping> clock;
+  std::shared_ptr<pipeline::jitter> lateness;
+  std::shared_ptr<capture::tap> capture_tap;
+  // Feeds the pipeline instead of dmsssrc when replaying a capture
+  std::unique_ptr<capture::player> player;
 
   source() : dmsssrc (nullptr), dmssdemux(nullptr), audio_decodebin(nullptr)
            , audioconvert(nullptr), filter(nullptr), audioresample(nullptr)
            , appsink(nullptr), video_appsink(nullptr), pipeline(nullptr)
-           , rganalysis(nullptr)
-           , current_level(0.)
-           , sample_signal{}, sample_video_signal{}
+           , current_level(audio::level{}.rms)
+           , audio_caps(nullptr), audio_format(GST_AUDIO_FORMAT_UNKNOWN)
   {
     std::cout << "default constructor " << this << std::endl;
   }
+  // Without audio the demuxed audio goes to a fakesink, so nothing
+  // after the demuxer is ever plugged to decode it
   source (std::string const& host, unsigned short port, std::string username
           , std::string const& password
-          , unsigned int channel, unsigned int subchannel)
-    : dmsssrc (gst_element_factory_make ("dmsssrc", "dmsssrc"))
-    , dmssdemux (gst_element_factory_make ("dmssdemux", "dmssdemux"))
-    , audio_decodebin (gst_element_factory_make ("decodebin", "decodebin"))
-    , audioconvert (gst_element_factory_make ("audioconvert", "audioconvert"))
-    , filter (gst_element_factory_make ("audiocheblimit", "audiocheblimit"))
-    , audioresample (gst_element_factory_make ("audioresample", "audioresample"))
-    , appsink (gst_element_factory_make ("appsink", "audio_appsink"))
-    , video_appsink (gst_element_factory_make ("appsink", "video_appsink"))
-    , video_queue (gst_element_factory_make ("queue", "video_queue"))
-    , audio_queue1 (gst_element_factory_make ("queue", "audio_queue1"))
-    , audio_queue2 (gst_element_factory_make ("queue", "audio_queue2"))
-    , rganalysis (gst_element_factory_make ("rganalysis", "rganalysis"))
-    , pipeline (gst_pipeline_new ("source_pipeline"))
+          , unsigned int channel, unsigned int subchannel, bool audio = true)
+    : source (gst_element_factory_make ("dmsssrc", "dmsssrc"), gst_element_factory_make ("dmssdemux", "dmssdemux")
+              , host + ":" + std::to_string (port) + "/" + std::to_string (channel) + "." + std::to_string (subchannel))
   {
-    std::cout << "normal constructor " << this << std::endl;
     if (!dmsssrc)
       throw std::runtime_error ("Couldn't create dmsssrc gstreamer plugin");
     if (!dmssdemux)
       throw std::runtime_error ("Couldn't create dmssdemux gstreamer plugin");
-    if(!audio_decodebin)
-      throw std::runtime_error ("Couldn't create decodebin gstreamer plugin");
-    if (!audioconvert)
-      throw std::runtime_error ("Couldn't create audioconvert gstreamer plugin");
-    if (!filter)
-      throw std::runtime_error ("Couldn't create audiocheblimit gstreamer plugin");
-    if (!audioresample)
-      throw std::runtime_error ("Couldn't create audioresample gstreamer plugin");
-    if (!appsink)
-      throw std::runtime_error ("Couldn't create appsink gstreamer plugin");
-    if (!video_appsink)
-      throw std::runtime_error ("Couldn't create video appsink gstreamer plugin");
-    if (!audio_queue1)
-      throw std::runtime_error ("Couldn't create queue1 gstreamer plugin");
-    if (!audio_queue2)
-      throw std::runtime_error ("Couldn't create queue2 gstreamer plugin");
-    if (!rganalysis)
-      throw std::runtime_error ("Couldn't create rganalysis gstreamer plugin");
-    if (!pipeline)
-      throw std::runtime_error ("Couldn't create pipeline for source");
 
     g_object_set (G_OBJECT (dmsssrc), "host", host.c_str(), "port", port, "user", username.c_str(), "password", password.c_str()
                   , "channel", channel, "subchannel", subchannel, NULL);
     g_object_set (G_OBJECT (dmsssrc), "timeout", 15, NULL);
-    g_object_set (G_OBJECT (rganalysis), "message", TRUE, NULL);
 
-    GstPad* appsink_sinkpad = gst_element_get_static_pad (audio_queue2, "sink");
-    g_signal_connect (audio_decodebin, "pad-added", G_CALLBACK (decodebin_newpad), appsink_sinkpad);
+    {
+      GstPad* pad = gst_element_get_static_pad (dmsssrc, "src");
+      metrics::probe (pad, std::shared_ptr<metrics::stage> (stages, &stages->ingress));
+      gst_object_unref (pad);
+    }
 
     {
-      GstPad* decodebin_sinkpad = gst_element_get_static_pad (audio_queue1, "sink");
+      GstElement* audio_sink = audio_queue1;
+      if (!audio)
+      {
+        audio_sink = gst_element_factory_make ("fakesink", "audio_discard");
+        if (!audio_sink)
+          throw std::runtime_error ("Couldn't create fakesink gstreamer plugin");
+        g_object_set (G_OBJECT (audio_sink), "sync", FALSE, "async", FALSE, NULL);
+        gst_bin_add (GST_BIN (pipeline), audio_sink);
+      }
+      GstPad* decodebin_sinkpad = gst_element_get_static_pad (audio_sink, "sink");
       g_signal_connect (dmssdemux, "pad-added", G_CALLBACK (dmssdemux_newpad), decodebin_sinkpad);
     }
 
-    std::cout << "this is " << this << std::endl;
-    
-    GstAppSinkCallbacks callbacks1
-      = {
-         &appsink_eos
-         , &appsink_preroll
-         , &appsink_sample
-        };
-    gst_app_sink_set_callbacks ( GST_APP_SINK(appsink), &callbacks1, this, appsink_notify_destroy);
-    GstAppSinkCallbacks callbacks2
-      = {
-         &appsink_eos
-         , &appsink_preroll
-         , &appsink_video_sample
-        };
-    gst_app_sink_set_callbacks ( GST_APP_SINK(video_appsink), &callbacks2, this, appsink_notify_destroy);
-
-    gst_bin_add_many (GST_BIN (pipeline), dmsssrc, dmssdemux, audio_decodebin, audioconvert, filter, audioresample, appsink
-                      , audio_queue1, audio_queue2, rganalysis, video_queue, video_appsink, NULL);
-    if (gst_element_link_many (dmsssrc, dmssdemux, video_queue, video_appsink, NULL) != TRUE
-        || gst_element_link_many (audio_queue2, rganalysis, audioconvert, audioresample, appsink, NULL) != TRUE
-        || gst_element_link_many (audio_queue1, audio_decodebin, NULL) != TRUE
-        )
+    gst_bin_add_many (GST_BIN (pipeline), dmsssrc, dmssdemux, NULL);
+    if (gst_element_link_many (dmsssrc, dmssdemux, video_queue, NULL) != TRUE)
     {
-      gst_object_unref (pipeline);
       throw std::runtime_error ("Elements could not be linked");
     }
+  }
 
-    GstBus* bus = gst_element_get_bus (pipeline);
-    gst_bus_add_signal_watch (bus);
-    bus_connection = g_signal_connect (G_OBJECT (bus), "message", G_CALLBACK (&source::message_cb), this);
-    std::cout << "registered " << bus_connection << std::endl;
-    gst_object_unref (GST_OBJECT (bus));
+  // Replays a capture written with capture, in real time or as fast
+  // as the pipeline goes, instead of connecting to an NVR
+  source (std::string const& capture_path, bool realtime)
+    : source (nullptr, nullptr, capture_path)
+  {
+    player.reset (new capture::player (capture_path, realtime));
+    if (!realtime)
+    {
+      g_object_set (G_OBJECT (appsink), "sync", FALSE, NULL);
+      g_object_set (G_OBJECT (video_appsink), "sync", FALSE, NULL);
+    }
+
+    gst_bin_add_many (GST_BIN (pipeline), player->audio, player->video, NULL);
+    if (gst_element_link (player->audio, audio_queue1) != TRUE
+        || gst_element_link (player->video, video_queue) != TRUE)
+    {
+      throw std::runtime_error ("Elements could not be linked");
+    }
   }
 
   ~source ()
   {
-    if (dmsssrc)
+    if (audio_caps)
+      gst_caps_unref (audio_caps);
+    if (pipeline)
     {
       std::cout << "should free elements" << std::endl;
       GstBus* bus = gst_element_get_bus (pipeline);
       std::cout << "clearing " << bus_connection << std::endl;
       g_clear_signal_handler(&bus_connection, bus);
       gst_object_unref (GST_OBJECT (bus));
+      gst_element_set_state (pipeline, GST_STATE_NULL);
+      gst_object_unref (pipeline);
     }
     else
     {
@@ -170,10 +179,21 @@ struct source
     std::swap(appsink, other.appsink);
     std::swap(video_appsink, other.video_appsink);
     std::swap(pipeline, other.pipeline);
+    std::swap(video, other.video);
+    std::swap(health, other.health);
     std::swap(bus_connection, other.bus_connection);
-    std::swap(current_level, other.current_level);
-    swap(sample_signal, other.sample_signal);
-    swap(sample_video_signal, other.sample_video_signal);
+    current_level = other.current_level.exchange (current_level);
+    std::swap(audio_caps, other.audio_caps);
+    std::swap(audio_format, other.audio_format);
+    swap(audio_ring, other.audio_ring);
+    swap(video_ring, other.video_ring);
+    swap(g711_ring, other.g711_ring);
+    swap(name, other.name);
+    swap(stages, other.stages);
+    swap(clock, other.clock);
+    swap(lateness, other.lateness);
+    swap(capture_tap, other.capture_tap);
+    swap(player, other.player);
     if (appsink)
     {
       GstAppSinkCallbacks callbacks1
@@ -247,9 +267,13 @@ struct source
     : dmsssrc(other.dmsssrc), dmssdemux(other.dmssdemux), audio_decodebin(other.audio_decodebin)
     , audioconvert(other.audioconvert), filter(other.filter)
     , audioresample(other.audioresample), appsink(other.appsink), video_appsink(other.video_appsink)
-    , pipeline(other.pipeline), sample_signal(std::move(other.sample_signal))
-    , sample_video_signal(std::move(other.sample_video_signal))
-    , bus_connection(other.bus_connection), current_level(other.current_level)
+    , pipeline(other.pipeline), video(std::move(other.video)), health(std::move(other.health)), audio_ring(std::move(other.audio_ring))
+    , video_ring(std::move(other.video_ring)), g711_ring(std::move(other.g711_ring))
+    , name(std::move(other.name)), stages(std::move(other.stages))
+    , clock(std::move(other.clock)), lateness(std::move(other.lateness))
+    , capture_tap(std::move(other.capture_tap)), player(std::move(other.player))
+    , bus_connection(other.bus_connection), current_level(other.current_level.load())
+    , audio_caps(other.audio_caps), audio_format(other.audio_format)
   {
     std::cout << "move constructor " << this << " from " << &other << std::endl;
     other.dmsssrc = nullptr;
@@ -260,6 +284,8 @@ struct source
     other.audioresample = nullptr;
     other.appsink = nullptr;
     other.video_appsink = nullptr;
+    other.audio_caps = nullptr;
+    other.pipeline = nullptr;
     std::cout << "MOVED this is " << this << std::endl;
     GstAppSinkCallbacks callbacks1
       = {
@@ -286,7 +312,162 @@ struct source
     gst_object_unref (GST_OBJECT (bus));
   }
   
+  // Records the demuxed streams from now on, null stops recording
+  void capture (std::shared_ptr<capture::writer> writer)
+  {
+    capture_tap->record (std::move (writer));
+  }
+
+  // Keeps the last seconds of the demuxed streams in ring, for clips
+  // that start before a trigger. Null stops keeping them.
+  void keep (std::shared_ptr<capture::pretrigger> ring)
+  {
+    capture_tap->keep (std::move (ring));
+  }
+
+  std::shared_ptr<capture::pretrigger> pretrigger () const
+  {
+    return std::atomic_load (&capture_tap->ring);
+  }
+
+  // Video is dropped at the demuxer until someone wants to watch.
+  // Enabling it delivers the GOP since the last keyframe first.
+  void enable_video ()
+  {
+    video->enable ();
+  }
+  void disable_video ()
+  {
+    video->disable ();
+  }
+
 private:
+  // Everything after the demuxer, which is the same whatever feeds it
+  source (GstElement* dmsssrc, GstElement* dmssdemux, std::string name)
+    : dmsssrc (dmsssrc)
+    , dmssdemux (dmssdemux)
+    , audio_decodebin (gst_element_factory_make ("decodebin", "decodebin"))
+    , audioconvert (gst_element_factory_make ("audioconvert", "audioconvert"))
+    , filter (gst_element_factory_make ("audiocheblimit", "audiocheblimit"))
+    , audioresample (gst_element_factory_make ("audioresample", "audioresample"))
+    , appsink (gst_element_factory_make ("appsink", "audio_appsink"))
+    , video_appsink (gst_element_factory_make ("appsink", "video_appsink"))
+    , video_queue (gst_element_factory_make ("queue", "video_queue"))
+    , audio_queue1 (gst_element_factory_make ("queue", "audio_queue1"))
+    , audio_queue2 (gst_element_factory_make ("queue", "audio_queue2"))
+    , pipeline (gst_pipeline_new ("source_pipeline"))
+    , current_level (audio::level{}.rms)
+    , audio_caps (nullptr), audio_format (GST_AUDIO_FORMAT_UNKNOWN)
+    , audio_ring (new sample_ring (256))
+    , video_ring (new sample_ring (512))
+    , g711_ring (new sample_ring (256))
+    , name (std::move (name))
+    , stages (new metrics::source_stages)
+    , clock (new clock_mapping)
+    , lateness (new pipeline::jitter)
+    , capture_tap (new capture::tap)
+  {
+    std::cout << "normal constructor " << this << std::endl;
+    if(!audio_decodebin)
+      throw std::runtime_error ("Couldn't create decodebin gstreamer plugin");
+    if (!audioconvert)
+      throw std::runtime_error ("Couldn't create audioconvert gstreamer plugin");
+    if (!filter)
+      throw std::runtime_error ("Couldn't create audiocheblimit gstreamer plugin");
+    if (!audioresample)
+      throw std::runtime_error ("Couldn't create audioresample gstreamer plugin");
+    if (!appsink)
+      throw std::runtime_error ("Couldn't create appsink gstreamer plugin");
+    if (!video_appsink)
+      throw std::runtime_error ("Couldn't create video appsink gstreamer plugin");
+    if (!audio_queue1)
+      throw std::runtime_error ("Couldn't create queue1 gstreamer plugin");
+    if (!audio_queue2)
+      throw std::runtime_error ("Couldn't create queue2 gstreamer plugin");
+    if (!pipeline)
+      throw std::runtime_error ("Couldn't create pipeline for source");
+
+    // Converted here, on the source's own thread, to what the mixer
+    // takes, at the rate of the stream. G.711 skips this and decodes
+    // to the same format.
+    GstCaps* appsink_caps = gst_caps_from_string (RTVC_AUDIO_INPUT_CAPS);
+    gst_app_sink_set_caps (GST_APP_SINK (appsink), appsink_caps);
+    gst_caps_unref (appsink_caps);
+
+    {
+      // Ingress times taken and recorded before the video gate drops
+      // anything
+      GstPad* pad = gst_element_get_static_pad (audio_queue1, "sink");
+      metrics::probe (pad, std::shared_ptr<metrics::stage> (stages, &stages->demux_audio), &stages->audio);
+      capture::tap::probe (pad, capture_tap, capture::stream::audio);
+      gst_object_unref (pad);
+      pad = gst_element_get_static_pad (video_queue, "sink");
+      metrics::probe (pad, std::shared_ptr<metrics::stage> (stages, &stages->demux_video), &stages->video);
+      capture::tap::probe (pad, capture_tap, capture::stream::video);
+      gst_object_unref (pad);
+    }
+
+    health.reset (new rtvc::pipeline::health (pipeline));
+    {
+      // Before the gate drops it, so a camera without audio, or whose
+      // video nobody watches, is still seen delivering
+      GstPad* pad = gst_element_get_static_pad (video_queue, "sink");
+      gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST)
+                         , &source::delivered_cb, health.get (), nullptr);
+      gst_object_unref (pad);
+    }
+    video.reset (new video_gate (gst_element_get_static_pad (video_queue, "sink")));
+    {
+      GstPad* pad = gst_element_get_static_pad (audio_queue1, "sink");
+      compressed_level (pad);
+      gst_object_unref (pad);
+    }
+
+    GstPad* appsink_sinkpad = gst_element_get_static_pad (audio_queue2, "sink");
+    g_signal_connect (audio_decodebin, "pad-added", G_CALLBACK (decodebin_newpad), appsink_sinkpad);
+
+    std::cout << "this is " << this << std::endl;
+    
+    GstAppSinkCallbacks callbacks1
+      = {
+         &appsink_eos
+         , &appsink_preroll
+         , &appsink_sample
+        };
+    gst_app_sink_set_callbacks ( GST_APP_SINK(appsink), &callbacks1, this, appsink_notify_destroy);
+    GstAppSinkCallbacks callbacks2
+      = {
+         &appsink_eos
+         , &appsink_preroll
+         , &appsink_video_sample
+        };
+    gst_app_sink_set_callbacks ( GST_APP_SINK(video_appsink), &callbacks2, this, appsink_notify_destroy);
+
+    gst_bin_add_many (GST_BIN (pipeline), audio_decodebin, audioconvert, filter, audioresample, appsink
+                      , audio_queue1, audio_queue2, video_queue, video_appsink, NULL);
+    if (gst_element_link_many (video_queue, video_appsink, NULL) != TRUE
+        || gst_element_link_many (audio_queue2, audioconvert, audioresample, appsink, NULL) != TRUE
+        || gst_element_link_many (audio_queue1, audio_decodebin, NULL) != TRUE
+        )
+    {
+      gst_object_unref (pipeline);
+      throw std::runtime_error ("Elements could not be linked");
+    }
+
+    GstBus* bus = gst_element_get_bus (pipeline);
+    gst_bus_add_signal_watch (bus);
+    bus_connection = g_signal_connect (G_OBJECT (bus), "message", G_CALLBACK (&source::message_cb), this);
+    std::cout << "registered " << bus_connection << std::endl;
+    gst_object_unref (GST_OBJECT (bus));
+  }
+
+
+  static GstPadProbeReturn delivered_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    static_cast<rtvc::pipeline::health*>(user_data)->delivered ();
+    return GST_PAD_PROBE_OK;
+  }
+
   static void decodebin_newpad (GstElement *decodebin, GstPad *pad, gpointer data)
   {
     std::cout << "decodebin_newpad" << std::endl;
@@ -339,11 +520,100 @@ private:
     assert (self->appsink == GST_ELEMENT(appsink));
     
     GstSample* sample = gst_app_sink_pull_sample (GST_APP_SINK (appsink));
-    self->sample_signal (sample);
-    gst_sample_unref (sample);
+    self->health->delivered ();
+    self->stages->appsink_audio.record (gst_sample_get_buffer (sample));
+    audio::level level = self->measure (sample);
+    self->current_level = level.rms;
+    self->audio_ring->push (sample, level);
 
     return GST_FLOW_OK;
   }
+  audio::level measure (GstSample* sample)
+  {
+    GstCaps* caps = gst_sample_get_caps (sample);
+    if (caps != audio_caps)
+    {
+      GstAudioInfo info;
+      if (!caps || !gst_audio_info_from_caps (&info, caps))
+        return audio::level{};
+      if (audio_caps)
+        gst_caps_unref (audio_caps);
+      audio_caps = gst_caps_ref (caps);
+      audio_format = GST_AUDIO_INFO_FORMAT (&info);
+    }
+
+    GstBuffer* buffer = gst_sample_get_buffer (sample);
+    GstMapInfo map;
+    if (!buffer || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+      return audio::level{};
+
+    audio::level_accumulator accumulator;
+    if (audio_format == GST_AUDIO_FORMAT_S16)
+      accumulator.add_s16 (reinterpret_cast<std::int16_t const*>(map.data), map.size / sizeof(std::int16_t));
+    else if (audio_format == GST_AUDIO_FORMAT_F32)
+      accumulator.add_f32 (reinterpret_cast<float const*>(map.data), map.size / sizeof(float));
+    gst_buffer_unmap (buffer, &map);
+    return accumulator.level ();
+  }
+
+  // G.711 never reaches the decoder: its level is measured from the
+  // encoded bytes and the sample goes to the dispatcher as it is. It is
+  // only decoded, with a table lookup, if it is played.
+  void compressed_level (GstPad* pad)
+  {
+    struct data
+    {
+      std::shared_ptr<sample_ring> ring;
+      std::shared_ptr<metrics::source_stages> stages;
+      rtvc::pipeline::health* health;
+      // G.711 caps, kept here since the event is dropped and so never
+      // sets the caps of the pad. Streaming thread only.
+      GstCaps* caps;
+      audio::g711::table const* table;
+
+      ~data ()
+      {
+        if (caps)
+          gst_caps_unref (caps);
+      }
+    };
+    gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+                       , [] (GstPad* pad, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn
+                         {
+                           data* self = static_cast<data*>(user_data);
+                           if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+                           {
+                             // Without caps decodebin doesn't even build a decoder
+                             GstEvent* event = GST_PAD_PROBE_INFO_EVENT (info);
+                             if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+                               return GST_PAD_PROBE_OK;
+                             GstCaps* caps;
+                             gst_event_parse_caps (event, &caps);
+                             self->table = audio::g711::table::from_caps (caps);
+                             gst_caps_replace (&self->caps, self->table ? caps : nullptr);
+                             return self->table ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+                           }
+
+                           if (!self->table)
+                             return GST_PAD_PROBE_OK;
+                           GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+                           // Silence, if the buffer can't be read
+                           audio::level level = audio::level ();
+                           GstMapInfo map;
+                           if (gst_buffer_map (buffer, &map, GST_MAP_READ))
+                           {
+                             level = audio::g711::level (*self->table, map.data, map.size);
+                             gst_buffer_unmap (buffer, &map);
+                           }
+                           self->health->delivered ();
+                           self->stages->appsink_audio.record (buffer);
+                           self->ring->push (gst_sample_new (buffer, self->caps, nullptr, nullptr), level);
+                           return GST_PAD_PROBE_DROP;
+                         }
+                       , new data{g711_ring, stages, health.get (), nullptr, nullptr}
+                       , [] (gpointer user_data) { delete static_cast<data*>(user_data); });
+  }
+
   static GstFlowReturn appsink_video_sample (GstAppSink *appsink, gpointer user_data)
   {
     //std::cout << "appsink sample " << user_data << std::endl;
@@ -353,8 +623,30 @@ private:
     assert (self->video_appsink == GST_ELEMENT(appsink));
     
     GstSample* sample = gst_app_sink_pull_sample (GST_APP_SINK (appsink));
-    self->sample_video_signal (sample);
-    gst_sample_unref (sample);
+    self->stages->appsink_video.record (gst_sample_get_buffer (sample));
+
+    // The GOP cached while the gate was closed goes first, so the
+    // decoder starts from a keyframe, and anything queued from before
+    // the gate opened is dropped
+    std::vector<GstBuffer*> gop;
+    if (!self->video->deliver (gst_sample_get_buffer (sample), gop))
+    {
+      gst_sample_unref (sample);
+      return GST_FLOW_OK;
+    }
+    if (!gop.empty ())
+    {
+      GstClockTime live = GST_BUFFER_TIMESTAMP (gst_sample_get_buffer (sample));
+      for (auto&& buffer : gop)
+      {
+        GstSample* preroll = gst_sample_new (buffer, gst_sample_get_caps (sample), gst_sample_get_segment (sample)
+                                             , gst_structure_new (preroll_sample_info, "live-timestamp", G_TYPE_UINT64, live, NULL));
+        self->video_ring->push (preroll);
+        gst_buffer_unref (buffer);
+      }
+    }
+
+    self->video_ring->push (sample);
 
     return GST_FLOW_OK;
   }
@@ -363,28 +655,12 @@ private:
   message_cb (GstBus * bus, GstMessage * message, gpointer user_data)
   {
     //std::cout << "message_cb " << GST_MESSAGE_TYPE (message) << std::endl;
-    if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ELEMENT)
-    {
-      ///std::cout << "which kind of element maybe? " << gst_structure_get_name (gst_message_get_structure(message)) << std::endl;
-      source* self = static_cast<source*>(user_data);
-      const GstStructure *s = gst_message_get_structure (message);
-      if (gst_structure_has_name (s, "rganalysis"))
-      {
-        if (gst_structure_has_field (s, "rglevel"))
-        {
-          double level = 0;
-          if (gst_structure_get_double (s, "rglevel", &level))
-          {
-            if (level > -10.)
-              std::cout << "level for current window is " << level << std::endl;
-            self->current_level = level;
-          }
-        }
-      }        
-    }
-    else if(GST_MESSAGE_TYPE (message) == GST_MESSAGE_ELEMENT)
+    if(GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR)
     {
       std::cout << "error" << std::endl; 
+      // Only this source is restarted, everything else keeps playing
+      source* self = static_cast<source*>(user_data);
+      self->health->failed ();
     }
 
     return TRUE;
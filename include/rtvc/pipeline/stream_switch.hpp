@@ -0,0 +1,65 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_STREAM_SWITCH_HPP
+#define RTVC_PIPELINE_STREAM_SWITCH_HPP
+
+#include <rtvc/pipeline/forward.hpp>
+
+#include <gst/gst.h>
+
+#include <memory>
+
+namespace rtvc { namespace pipeline {
+
+// Feeds one appsrc with a channel's substream video until the main
+// stream delivers its first keyframe, then with the main stream only.
+// Each stream is placed by the clock mapping of its source on the
+// running time of pipeline, which may already be playing other
+// sources, so the switch neither jumps nor loses sync with the audio.
+struct stream_switch
+{
+  forwarder output;
+  GstElement* pipeline;
+  bool on_main;
+
+  stream_switch (GstElement* appsrc, GstElement* pipeline, std::shared_ptr<clock_mapping const> clock
+                 , metrics::ingress_times const* times)
+    : output (appsrc), pipeline (pipeline), on_main (false)
+  {
+    output.follow (std::move (clock), pipeline, times);
+  }
+
+  GstFlowReturn push_sub (GstSample* sample)
+  {
+    if (on_main)
+      return GST_FLOW_OK;
+    return output.push (sample);
+  }
+
+  GstFlowReturn push_main (GstSample* sample, std::shared_ptr<clock_mapping const> const& clock
+                           , metrics::ingress_times const* times)
+  {
+    if (!on_main)
+    {
+      GstBuffer* buffer = gst_sample_get_buffer (sample);
+      if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+        return GST_FLOW_OK;
+
+      // The main stream has its own timeline and mapping
+      output.follow (clock, pipeline, times);
+      on_main = true;
+    }
+    return output.push (sample);
+  }
+};
+
+} }
+
+#endif
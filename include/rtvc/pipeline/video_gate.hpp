@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_PIPELINE_VIDEO_GATE_HPP
+#define RTVC_PIPELINE_VIDEO_GATE_HPP
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <vector>
+#include <stdexcept>
+
+namespace rtvc { namespace pipeline {
+
+// Drops video buffers as they leave the demuxer while nobody is
+// watching, so the video queue and appsink never see them. Events
+// still pass, so caps are already known when the gate opens.
+//
+// Meanwhile the compressed buffers since the last keyframe are kept
+// by reference, so whoever opens the gate can start decoding from
+// that keyframe instead of waiting for the next one.
+//
+// The cache is only touched on the demuxer streaming thread and the
+// gate is an atomic, so buffers pass without a lock. Opening the gate
+// is seen by the next buffer, which hands the GOP over together with
+// itself as the first live buffer. On the appsink side, see deliver,
+// whatever the queue still held from before is dropped up to that
+// buffer, and the GOP goes right before it, so a quick close and open
+// never mixes stale buffers in.
+struct video_gate
+{
+  // The GOP to deliver before first, the first buffer let through
+  // after the gate opened, and how many buffers the queue held before
+  // it. Made on the streaming thread, owned by the appsink thread once
+  // taken.
+  struct handover
+  {
+    std::vector<GstBuffer*> gop;
+    GstBuffer* first;
+    guint queued;
+
+    handover () : first (nullptr), queued (0) {}
+    ~handover ()
+    {
+      clear (gop);
+      if (first)
+        gst_buffer_unref (first);
+    }
+    handover (handover const&) = delete;
+    handover& operator=(handover const&) = delete;
+  };
+
+  GstPad* pad;
+  gulong probe;
+  std::atomic<bool> enabled;
+  // Bumped by every enable, the streaming thread hands a GOP over
+  // once per value
+  std::atomic<unsigned int> generation;
+  std::atomic<handover*> ready;
+
+  // Streaming thread only
+  unsigned int handed;
+  std::vector<GstBuffer*> gop;
+  std::size_t gop_bytes;
+  std::size_t max_buffers, max_bytes;
+  bool gop_valid;
+
+  // Appsink thread only
+  handover* current;
+  guint dropped;
+
+  video_gate (GstPad* pad, std::size_t max_buffers = 300, std::size_t max_bytes = 8*1024*1024)
+    : pad (pad), probe (0), enabled (false), generation (0), ready (nullptr)
+    , handed (0), gop_bytes (0), max_buffers (max_buffers), max_bytes (max_bytes)
+    , gop_valid (false), current (nullptr), dropped (0)
+  {
+    if (!pad)
+      throw std::runtime_error ("No pad to gate video on");
+    gop.reserve (max_buffers);
+    probe = gst_pad_add_probe (pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST
+                                                                 | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+                               , &video_gate::probe_cb, this, nullptr);
+  }
+  ~video_gate ()
+  {
+    gst_pad_remove_probe (pad, probe);
+    gst_object_unref (pad);
+    clear (gop);
+    delete ready.exchange (nullptr);
+    delete current;
+  }
+
+  video_gate (video_gate const&) = delete;
+  video_gate& operator=(video_gate const&) = delete;
+
+  // The cached GOP is delivered in order right before the first live
+  // buffer, see deliver
+  void enable ()
+  {
+    ++generation;
+    enabled = true;
+  }
+  void disable ()
+  {
+    enabled = false;
+  }
+
+  // Called on the appsink thread with every buffer that reached it.
+  // Returns false for a buffer to drop, else swaps the GOP to deliver
+  // before it into buffers, which must be empty. The caller owns the
+  // references.
+  bool deliver (GstBuffer* buffer, std::vector<GstBuffer*>& buffers)
+  {
+    if (!enabled)
+      return false;
+    if (handover* h = ready.exchange (nullptr))
+    {
+      delete current;
+      current = h;
+      dropped = 0;
+    }
+    if (!current)
+      return true;
+    if (buffer != current->first)
+    {
+      // Queued before the gate opened. Should the first live buffer
+      // never come, e.g. the pipeline restarted, live data resumes
+      // once everything queued before was dropped, without the GOP.
+      if (dropped++ < current->queued)
+        return false;
+    }
+    else
+      buffers.swap (current->gop);
+    delete current;
+    current = nullptr;
+    return true;
+  }
+
+private:
+  static void clear (std::vector<GstBuffer*>& buffers)
+  {
+    for (auto&& buffer : buffers)
+      gst_buffer_unref (buffer);
+    buffers.clear ();
+  }
+
+  void cache (GstBuffer* buffer)
+  {
+    if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    {
+      clear (gop);
+      gop_bytes = 0;
+      gop_valid = true;
+    }
+    if (!gop_valid)
+      return;
+
+    std::size_t size = gst_buffer_get_size (buffer);
+    if (gop.size () == max_buffers || gop_bytes + size > max_bytes)
+    {
+      // A GOP without its head can't be decoded, wait for the next keyframe
+      clear (gop);
+      gop_bytes = 0;
+      gop_valid = false;
+      return;
+    }
+    gop.push_back (gst_buffer_ref (buffer));
+    gop_bytes += size;
+  }
+
+  // With the gate just opened, before first goes through
+  void hand_over (GstBuffer* first)
+  {
+    handover* h = new handover;
+    // Nothing to decode before a keyframe
+    if (gop_valid && GST_BUFFER_FLAG_IS_SET (first, GST_BUFFER_FLAG_DELTA_UNIT))
+      for (auto&& buffer : gop)
+        h->gop.push_back (gst_buffer_ref (buffer));
+    h->first = gst_buffer_ref (first);
+    if (GstElement* queue = gst_pad_get_parent_element (pad))
+    {
+      g_object_get (G_OBJECT (queue), "current-level-buffers", &h->queued, NULL);
+      gst_object_unref (queue);
+    }
+    // One the appsink side never took is from an earlier opening
+    delete ready.exchange (h);
+  }
+
+  static gboolean cache_cb (GstBuffer** buffer, guint index, gpointer user_data)
+  {
+    static_cast<video_gate*>(user_data)->cache (*buffer);
+    return TRUE;
+  }
+
+  static GstPadProbeReturn probe_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    video_gate* self = static_cast<video_gate*>(user_data);
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+      // A new connection, the GOP of the last one can't be decoded
+      // with what comes next
+      if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_STREAM_START)
+      {
+        self->clear (self->gop);
+        self->gop_bytes = 0;
+        self->gop_valid = false;
+      }
+      return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* first;
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+      GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+      if (!gst_buffer_list_length (list))
+        return GST_PAD_PROBE_OK;
+      first = gst_buffer_list_get (list, 0);
+      if (self->enabled && self->handed != self->generation)
+      {
+        self->handed = self->generation;
+        self->hand_over (first);
+      }
+      gst_buffer_list_foreach (list, &video_gate::cache_cb, self);
+    }
+    else
+    {
+      first = GST_PAD_PROBE_INFO_BUFFER (info);
+      if (self->enabled && self->handed != self->generation)
+      {
+        self->handed = self->generation;
+        self->hand_over (first);
+      }
+      self->cache (first);
+    }
+    return self->enabled ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+  }
+};
+
+} }
+
+#endif
@@ -14,52 +14,124 @@
 #include <gst/app/gstappsrc.h>
 #include <gst/video/video.h>
 
+#include <rtvc/video/nal.hpp>
+
 #include <string>
 #include <stdexcept>
+#include <iostream>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
 
 namespace rtvc { namespace pipeline {
 
-struct visualization
+// Shared by the tiles of a visualization. overloaded follows the QoS
+// events of the video sink: the display can't keep up and frames get
+// late.
+struct display_qos
+{
+  // Of the canvas, zero for as fast as the sources
+  GstClockTime frame_interval;
+  std::atomic<bool> overloaded;
+
+  display_qos (GstClockTime frame_interval) : frame_interval (frame_interval), overloaded (false) {}
+};
+
+// One source on screen: appsrc ! decodebin ! queue ! videoscale !
+// capsfilter ! [videoflip !] compositor. Each tile is decoded as small
+// as the decoder can go and scaled to its own size right after, so
+// the compositor never sees a full resolution frame, and is rotated
+// once scaled. Only JPEG and MPEG decoders can decode smaller; for
+// H.264 and H.265 the work is saved upstream instead, by not feeding
+// a tile a larger stream than it shows, see upscaled.
+//
+// decodebin doesn't plug anew when the media type changes, e.g. from
+// an H.264 substream to an H.265 main stream, so the tile replaces its
+// decodebin when the caps it is fed change to another media type. The
+// appsrc is blocked on those caps meanwhile and the main loop swaps
+// decodebins, not the streaming thread feeding the old one.
+//
+// Non-reference pictures are dropped before decoding while the stream
+// is faster than the display or the display is overloaded. The queue
+// after the decoder only holds a couple of frames and drops the older
+// ones, so a slow display lowers the frame rate instead of piling up
+// latency.
+struct tile
 {
+  GstElement* pipeline;
+  unsigned int number;
   GstElement* appsrc;
   GstElement* decodebin;
   GstElement* queue;
-  GstElement* videoflip;
   GstElement* videoscale;
   GstElement* scale_capsfilter;
-  GstElement* videoconvert;
-  GstElement *sink;
-  GstElement *pipeline;
+  GstElement* videoflip;
+  GstPad* mixer_pad;
+  bool in_use;
+  bool flip;
+  // On screen, after rotation
+  std::atomic<int> width, height;
+  std::atomic<gint64> attach_time;
+  // Of the last attach of this tile, in microseconds, -1 before the
+  // first frame
+  std::atomic<gint64> first_frame;
+  std::atomic<gint64>* time_to_first_frame;
+  display_qos const* qos;
+  // Streaming thread of the appsrc only
+  video::codec codec;
+  // Media type decodebin was plugged for, or is being replugged for,
+  // empty before the first caps
+  std::string plugged;
+  // Probe blocking the appsrc until the main loop has replugged, and
+  // whether a replug_cb is on its way
+  gulong block_probe;
+  std::atomic<bool> replug_pending;
+  GstClockTime last_timestamp;
+  // Average time between frames of the stream, zero before known
+  double frame_interval;
 
-  visualization (int width, int height, bool flip)
-    : appsrc (gst_element_factory_make ("appsrc", "video_appsrc"))
-    , decodebin (gst_element_factory_make ("decodebin", "video_decodebin"))
+  tile (GstElement* pipeline, GstElement* compositor, unsigned int number, bool flip
+        , std::atomic<gint64>* time_to_first_frame, display_qos const* qos)
+    : pipeline (pipeline)
+    , number (number)
+    , appsrc (make ("appsrc", "video_appsrc", number))
+    , decodebin (make ("decodebin", "video_decodebin", number))
+    , queue (make ("queue", "video_queue", number))
+    , videoscale (make ("videoscale", "videoscale", number))
+    , scale_capsfilter (make ("capsfilter", "scale_capsfilter", number))
     , videoflip (nullptr)
-    , queue (gst_element_factory_make ("queue", "video_queue"))
-    , videoscale (gst_element_factory_make ("videoscale", "videoscale"))
-    , scale_capsfilter (gst_element_factory_make ("capsfilter", "scale_capsfilter"))
-    , videoconvert (gst_element_factory_make ("videoconvert", "videoconvert"))
-    , sink (gst_element_factory_make ("autovideosink", "autovideoxsink"))
-    , pipeline (gst_pipeline_new ("video_pipeline"))
+    , mixer_pad (nullptr)
+    , in_use (false)
+    , flip (flip)
+    , width (0), height (0)
+    , attach_time (0)
+    , first_frame (-1)
+    , time_to_first_frame (time_to_first_frame)
+    , qos (qos)
+    , codec (video::codec::other)
+    , block_probe (0)
+    , replug_pending (false)
+    , last_timestamp (GST_CLOCK_TIME_NONE)
+    , frame_interval (0.)
   {
     if (!appsrc)
       throw std::runtime_error ("Couldn't create appsrc plugin");
     if (!decodebin)
       throw std::runtime_error ("Couldn't create video decodebin plugin");
+    if (!queue)
+      throw std::runtime_error ("Couldn't create queue plugin");
     if (!videoscale)
       throw std::runtime_error ("Couldn't create videoscale plugin");
     if (!scale_capsfilter)
       throw std::runtime_error ("Couldn't create capsfilter plugin");
-    if (!videoconvert)
-      throw std::runtime_error ("Couldn't create videoconvert plugin");
-    if (!sink)
-      throw std::runtime_error ("Couldn't create autovideosink plugin");
-    if (!pipeline)
-      throw std::runtime_error ("Couldn't create video pipeline");
 
     if (flip)
     {
-      videoflip = gst_element_factory_make ("videoflip", "videoflip");
+      videoflip = make ("videoflip", "videoflip", number);
       if (!videoflip)
         throw std::runtime_error ("Couldn't create videoflip plugin");
       g_object_set (G_OBJECT (videoflip), "video-direction", GST_VIDEO_ORIENTATION_90R, NULL);
@@ -69,27 +141,270 @@ struct visualization
     g_object_set (G_OBJECT (appsrc), "format", GST_FORMAT_TIME, NULL);
     g_object_set (G_OBJECT (appsrc), "is-live", TRUE, NULL);
     gst_app_src_set_stream_type(GST_APP_SRC(appsrc), GST_APP_STREAM_TYPE_STREAM);
+    g_object_set (G_OBJECT (queue), "leaky", 2, "max-size-buffers", 2
+                  , "max-size-time", G_GUINT64_CONSTANT (0), "max-size-bytes", 0, NULL);
 
-    GstCaps* scale_caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
-    g_object_set(G_OBJECT (scale_capsfilter), "caps", scale_caps, NULL);
-    gst_caps_unref (scale_caps);
-    
-    GstPad* queue_sinkpad = gst_element_get_static_pad (queue, "sink");
-    g_signal_connect (decodebin, "pad-added", G_CALLBACK (decodebin_newpad), queue_sinkpad);
+    connect_decodebin ();
 
-    gst_bin_add_many (GST_BIN (pipeline), appsrc, decodebin, queue, videoscale, scale_capsfilter, videoconvert, sink, NULL);
+    gst_bin_add_many (GST_BIN (pipeline), appsrc, decodebin, queue, videoscale, scale_capsfilter, NULL);
     if (gst_element_link_many (appsrc, decodebin, NULL) != TRUE
-        || (!flip ? gst_element_link_many (queue, videoscale, scale_capsfilter, videoconvert, sink, NULL)
-            : gst_element_link_many (queue, videoflip, videoscale, scale_capsfilter, videoconvert, sink, NULL)
-            ) != TRUE)
+        || gst_element_link_many (queue, videoscale, scale_capsfilter, NULL) != TRUE
+        || (flip && gst_element_link (scale_capsfilter, videoflip) != TRUE))
     {
       throw std::runtime_error ("Elements could not be linked.\n");
-    }    
-    
+    }
+
+    GstPad* pad = gst_element_get_static_pad (appsrc, "src");
+    gst_pad_add_probe (pad, GstPadProbeType (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+                       , &tile::skip_cb, this, nullptr);
+    gst_object_unref (pad);
+
+    // Parked tiles stay linked but invisible, so they can be reused
+    // without touching the compositor
+    mixer_pad = gst_element_get_request_pad (compositor, "sink_%u");
+    assert (!!mixer_pad);
+    g_object_set (G_OBJECT (mixer_pad), "alpha", 0., NULL);
+    GstPad* src_pad = gst_element_get_static_pad (flip ? videoflip : scale_capsfilter, "src");
+    gst_pad_link (src_pad, mixer_pad);
+    gst_pad_add_probe (src_pad, GST_PAD_PROBE_TYPE_BUFFER, &tile::first_frame_cb, this, nullptr);
+    gst_object_unref (src_pad);
   }
-  ~visualization()
+
+  // Freed stopped, so no probe adds a replug anymore
+  ~tile ()
   {
-    gst_object_unref (pipeline);
+    if (replug_pending)
+      g_idle_remove_by_data (this);
+  }
+
+  tile (tile const&) = delete;
+  tile& operator=(tile const&) = delete;
+
+  // On the main loop, with the appsrc blocked on the caps of the new
+  // media type. Removing the old decodebin unlinks it from the queue,
+  // the new one links to it once it has plugged a decoder, and the
+  // sticky events of the appsrc go to it once unblocked.
+  void replug ()
+  {
+    std::cout << "tile " << number << " fed another media type, replacing its decoder" << std::endl;
+    gst_element_unlink (appsrc, decodebin);
+    gst_element_set_state (decodebin, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (pipeline), decodebin);
+    // Its name is free again
+    decodebin = make ("decodebin", "video_decodebin", number);
+    assert (!!decodebin);
+    connect_decodebin ();
+    gst_bin_add (GST_BIN (pipeline), decodebin);
+    gst_element_link (appsrc, decodebin);
+    gst_element_sync_state_with_parent (decodebin);
+  }
+
+  static GstPadProbeReturn block_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    tile* self = static_cast<tile*>(user_data);
+    // Again for the caps resent after a flush
+    if (!self->replug_pending.exchange (true))
+      g_idle_add (&tile::replug_cb, self);
+    return GST_PAD_PROBE_OK;
+  }
+
+  static gboolean replug_cb (gpointer user_data)
+  {
+    tile* self = static_cast<tile*>(user_data);
+    self->replug ();
+    GstPad* pad = gst_element_get_static_pad (self->appsrc, "src");
+    gst_pad_remove_probe (pad, self->block_probe);
+    gst_object_unref (pad);
+    self->replug_pending = false;
+    return G_SOURCE_REMOVE;
+  }
+
+  // Whether the tile is shown larger than its stream is decoded, as of
+  // the first frame since it was attached, so a larger stream would
+  // show more. The decoded caps stay on the queue across a detach, so
+  // before that frame they may be another camera's.
+  bool upscaled () const
+  {
+    if (first_frame < 0)
+      return false;
+    GstPad* pad = gst_element_get_static_pad (queue, "sink");
+    GstCaps* caps = gst_pad_get_current_caps (pad);
+    gst_object_unref (pad);
+    gint decoded_width = 0, decoded_height = 0;
+    if (caps)
+    {
+      GstStructure const* s = gst_caps_get_structure (caps, 0);
+      gst_structure_get_int (s, "width", &decoded_width);
+      gst_structure_get_int (s, "height", &decoded_height);
+      gst_caps_unref (caps);
+    }
+    // Tile size before rotation
+    int w = flip ? height : width, h = flip ? width : height;
+    return decoded_width > 0 && decoded_height > 0 && (w > decoded_width || h > decoded_height);
+  }
+
+  void resize (int x, int y, int w, int h)
+  {
+    if (w != width || h != height)
+    {
+      // Scaled before it is rotated
+      GstCaps* scale_caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, flip ? h : w
+                                                , "height", G_TYPE_INT, flip ? w : h, NULL);
+      g_object_set(G_OBJECT (scale_capsfilter), "caps", scale_caps, NULL);
+      gst_caps_unref (scale_caps);
+      width = w;
+      height = h;
+    }
+    g_object_set (G_OBJECT (mixer_pad), "xpos", x, "ypos", y, NULL);
+  }
+
+  // Every element of the tile, for state changes
+  std::vector<GstElement*> elements () const
+  {
+    std::vector<GstElement*> all {appsrc, decodebin, queue, videoscale, scale_capsfilter};
+    if (videoflip)
+      all.push_back (videoflip);
+    return all;
+  }
+
+  void connect_decodebin ()
+  {
+    GstPad* queue_sinkpad = gst_element_get_static_pad (queue, "sink");
+    g_signal_connect_data (decodebin, "pad-added", G_CALLBACK (decodebin_newpad), queue_sinkpad
+                           , [] (gpointer pad, GClosure*) { gst_object_unref (pad); }, GConnectFlags (0));
+    g_signal_connect (decodebin, "element-added", G_CALLBACK (decodebin_element_added), this);
+  }
+
+  static GstElement* make (char const* factory, std::string name, unsigned int number)
+  {
+    name += std::to_string (number);
+    return gst_element_factory_make (factory, name.c_str());
+  }
+
+  static GstPadProbeReturn first_frame_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    tile* self = static_cast<tile*>(user_data);
+    gint64 start = self->attach_time.exchange (0);
+    if (start)
+    {
+      self->first_frame = g_get_monotonic_time () - start;
+      *self->time_to_first_frame = self->first_frame.load ();
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  static GstPadProbeReturn skip_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    tile* self = static_cast<tile*>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+      GstEvent* event = GST_PAD_PROBE_INFO_EVENT (info);
+      if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS)
+      {
+        GstCaps* caps;
+        gst_event_parse_caps (event, &caps);
+        self->codec = video::codec_from_caps (caps);
+        if (caps && !gst_caps_is_empty (caps))
+        {
+          char const* media_type = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+          // Blocked from this event on, the probe runs right after
+          if (!self->plugged.empty () && self->plugged != media_type)
+            self->block_probe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM
+                                                   , &tile::block_cb, self, nullptr);
+          self->plugged = media_type;
+        }
+      }
+      else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      {
+        // Detached, whatever comes next may be another camera
+        self->last_timestamp = GST_CLOCK_TIME_NONE;
+        self->frame_interval = 0.;
+      }
+      return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+    if (GST_CLOCK_TIME_IS_VALID (timestamp) && GST_CLOCK_TIME_IS_VALID (self->last_timestamp)
+        && timestamp > self->last_timestamp && timestamp - self->last_timestamp < GST_SECOND)
+    {
+      double interval = timestamp - self->last_timestamp;
+      self->frame_interval = self->frame_interval ? self->frame_interval * 0.9 + interval * 0.1 : interval;
+    }
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+      self->last_timestamp = timestamp;
+
+    // Half again as fast as the display, at least
+    bool faster = self->qos->frame_interval && self->frame_interval
+      && self->frame_interval * 1.5 < self->qos->frame_interval;
+    if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)
+        || self->codec == video::codec::other
+        || !(faster || self->qos->overloaded))
+      return GST_PAD_PROBE_OK;
+
+    GstMapInfo map;
+    if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+      return GST_PAD_PROBE_OK;
+    bool drop = video::non_reference (self->codec, map.data, map.size);
+    gst_buffer_unmap (buffer, &map);
+    return drop ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+  }
+
+  // Decoders that can decode at a fraction of the size are told to as
+  // soon as they know the size of the stream, as far as the tile is
+  // still covered. Every libav decoder has lowres, but only the JPEG,
+  // MPEG and H.263 ones honour it, H.264 and H.265 decode at full size.
+  static bool lowres_supported (GstCaps* caps)
+  {
+    if (!caps || gst_caps_is_empty (caps))
+      return false;
+    GstStructure const* s = gst_caps_get_structure (caps, 0);
+    return gst_structure_has_name (s, "image/jpeg") || gst_structure_has_name (s, "video/mpeg")
+      || gst_structure_has_name (s, "video/x-h263");
+  }
+
+  static void decodebin_element_added (GstBin* bin, GstElement* element, gpointer data)
+  {
+    if (!g_object_class_find_property (G_OBJECT_GET_CLASS (element), "lowres"))
+      return;
+    GstPad* pad = gst_element_get_static_pad (element, "sink");
+    if (!pad)
+      return;
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, &tile::lowres_cb, data, nullptr);
+    gst_object_unref (pad);
+  }
+
+  static GstPadProbeReturn lowres_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    tile* self = static_cast<tile*>(user_data);
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+      return GST_PAD_PROBE_OK;
+    GstCaps* caps;
+    gst_event_parse_caps (event, &caps);
+    if (!lowres_supported (caps))
+      return GST_PAD_PROBE_OK;
+    GstStructure const* s = gst_caps_get_structure (caps, 0);
+    gint width = 0, height = 0;
+    if (!gst_structure_get_int (s, "width", &width) || !gst_structure_get_int (s, "height", &height))
+      return GST_PAD_PROBE_OK;
+    // Tile size before rotation. Half and quarter are what decoders offer.
+    int w = self->flip ? self->height : self->width, h = self->flip ? self->width : self->height;
+    if (w <= 0 || h <= 0)
+      return GST_PAD_PROBE_OK;
+    int lowres = 0;
+    while (lowres < 2 && (width >> (lowres + 1)) >= w && (height >> (lowres + 1)) >= h)
+      ++lowres;
+    GstElement* decoder = gst_pad_get_parent_element (pad);
+    if (decoder)
+    {
+      if (lowres)
+        std::cout << "decoding " << width << "x" << height << " at 1/" << (1 << lowres) << " for a "
+                  << w << "x" << h << " tile" << std::endl;
+      g_object_set (G_OBJECT (decoder), "lowres", lowres, NULL);
+      gst_object_unref (decoder);
+    }
+    return GST_PAD_PROBE_OK;
   }
 
   static void decodebin_newpad (GstElement *decodebin, GstPad *pad, gpointer data)
@@ -103,11 +418,255 @@ struct visualization
     }
     else
     {
-      // 
+      //
+    }
+  }
+};
+
+// Mosaic of every triggered source: compositor ! capsfilter !
+// videoconvert ! autovideosink. Built once and parked in PAUSED while
+// no tile is shown. Tiles are kept for reuse once created, so showing
+// a source is a property change instead of building and negotiating
+// a new branch; a reused tile fed another codec replaces its decoder,
+// see tile. Tiles are freed with release and trim once no channel
+// needs them. With a framerate the canvas is composed at that rate,
+// zero follows the sources.
+struct visualization
+{
+  GstElement* compositor;
+  GstElement* canvas_capsfilter;
+  GstElement* videoconvert;
+  GstElement *sink;
+  GstElement *pipeline;
+  int width, height;
+  bool flip;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<rtvc::pipeline::tile>> tiles;
+  // Tiles ever created, names stay unique as tiles are freed
+  unsigned int created;
+  // Time from attach to the first frame of a tile reaching the
+  // compositor, in microseconds, for the last attach
+  std::atomic<gint64> time_to_first_frame;
+  display_qos qos;
+
+  // sink_factory replaces autovideosink, e.g. with a fakesink to run
+  // without a display
+  visualization (int width, int height, bool flip, char const* sink_factory = "autovideosink"
+                 , unsigned int framerate = 0)
+    : compositor (gst_element_factory_make ("compositor", "compositor"))
+    , canvas_capsfilter (gst_element_factory_make ("capsfilter", "canvas_capsfilter"))
+    , videoconvert (gst_element_factory_make ("videoconvert", "videoconvert"))
+    , sink (gst_element_factory_make (sink_factory, "autovideoxsink"))
+    , pipeline (gst_pipeline_new ("video_pipeline"))
+    , width (width), height (height), flip (flip)
+    , created (0)
+    , time_to_first_frame (-1)
+    , qos (framerate ? GST_SECOND / framerate : 0)
+  {
+    if (!compositor)
+      throw std::runtime_error ("Couldn't create compositor plugin");
+    if (!canvas_capsfilter)
+      throw std::runtime_error ("Couldn't create capsfilter plugin");
+    if (!videoconvert)
+      throw std::runtime_error ("Couldn't create videoconvert plugin");
+    if (!sink)
+      throw std::runtime_error (std::string ("Couldn't create ") + sink_factory + " plugin");
+    if (!pipeline)
+      throw std::runtime_error ("Couldn't create video pipeline");
+    // Sources are mapped to the monotonic clock, as for sound_sink
+    GstClock* clock = gst_system_clock_obtain ();
+    gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
+    gst_object_unref (clock);
+
+    GstCaps* canvas_caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+    if (framerate)
+      gst_caps_set_simple (canvas_caps, "framerate", GST_TYPE_FRACTION, framerate, 1, NULL);
+    g_object_set(G_OBJECT (canvas_capsfilter), "caps", canvas_caps, NULL);
+    gst_caps_unref (canvas_caps);
+
+    gst_bin_add_many (GST_BIN (pipeline), compositor, canvas_capsfilter, videoconvert, sink, NULL);
+    if (gst_element_link_many (compositor, canvas_capsfilter, videoconvert, sink, NULL) != TRUE)
+    {
+      throw std::runtime_error ("Elements could not be linked.\n");
+    }
+
+    GstPad* pad = gst_element_get_static_pad (compositor, "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, &visualization::qos_cb, &qos, nullptr);
+    gst_object_unref (pad);
+
+    // One tile ready for the first trigger
+    tiles.emplace_back (new rtvc::pipeline::tile (pipeline, compositor, created++, flip, &time_to_first_frame, &qos));
+
+    gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  }
+  ~visualization()
+  {
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    for (auto&& tile : tiles)
+    {
+      gst_element_release_request_pad (compositor, tile->mixer_pad);
+      gst_object_unref (tile->mixer_pad);
     }
+    gst_object_unref (pipeline);
+  }
+
+  visualization (visualization const&) = delete;
+  visualization& operator=(visualization const&) = delete;
+
+  // Gives a tile whose appsrc is shown from now on
+  rtvc::pipeline::tile* attach ()
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    rtvc::pipeline::tile* free = nullptr;
+    for (auto&& tile : tiles)
+      if (!tile->in_use)
+      {
+        free = tile.get ();
+        break;
+      }
+    if (!free)
+    {
+      tiles.emplace_back (new rtvc::pipeline::tile (pipeline, compositor, created++, flip, &time_to_first_frame, &qos));
+      free = tiles.back ().get ();
+      for (GstElement* element : free->elements ())
+        gst_element_sync_state_with_parent (element);
+    }
+
+    free->first_frame = -1;
+    free->attach_time = g_get_monotonic_time ();
+    free->in_use = true;
+    layout ();
+    g_object_set (G_OBJECT (free->mixer_pad), "alpha", 1., NULL);
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+    return free;
+  }
+
+  // Hides the tile and drops what it has in flight. The pipeline is
+  // parked again once the last tile is gone, with decoders and sink
+  // keeping their negotiated caps.
+  void detach (rtvc::pipeline::tile* tile)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    tile->in_use = false;
+    tile->attach_time = 0;
+    g_object_set (G_OBJECT (tile->mixer_pad), "alpha", 0., NULL);
+    gst_element_send_event (tile->appsrc, gst_event_new_flush_start ());
+    gst_element_send_event (tile->appsrc, gst_event_new_flush_stop (FALSE));
+    layout ();
+    if (!active_unlocked ())
+      gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  }
+
+  // Hides the tile and frees it, e.g. its channel was removed
+  void release (rtvc::pipeline::tile* tile)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    auto it = std::find_if (tiles.begin (), tiles.end (), [tile] (std::unique_ptr<rtvc::pipeline::tile> const& t)
+                            { return t.get () == tile; });
+    if (it == tiles.end ())
+      return;
+    free_tile (it);
+    layout ();
+    if (!active_unlocked ())
+      gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  }
+
+  // Frees parked tiles until at most keep tiles are left, keeping one
+  // for the next trigger
+  void trim (std::size_t keep)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    keep = std::max<std::size_t> (keep, 1);
+    for (auto it = tiles.begin (); it != tiles.end () && tiles.size () > keep;)
+      if ((*it)->in_use)
+        ++it;
+      else
+        it = free_tile (it);
+  }
+
+  unsigned int active ()
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    return active_unlocked ();
+  }
+
+  GstClockTime running_time () const
+  {
+    GstClock* clock = gst_element_get_clock (pipeline);
+    if (!clock)
+      return 0;
+    GstClockTime now = gst_clock_get_time (clock) - gst_element_get_base_time (pipeline);
+    gst_object_unref (clock);
+    return now;
+  }
+
+private:
+  // Overloaded while frames reach the sink late, until they are well
+  // in time again
+  static GstPadProbeReturn qos_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+  {
+    display_qos* qos = static_cast<display_qos*>(user_data);
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) != GST_EVENT_QOS)
+      return GST_PAD_PROBE_OK;
+    GstQOSType type;
+    gdouble proportion;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+    gst_event_parse_qos (event, &type, &proportion, &diff, &timestamp);
+    if (!qos->overloaded && (proportion > 1.1 || diff > 0))
+      qos->overloaded = true;
+    else if (qos->overloaded && proportion < 0.8 && diff < 0)
+      qos->overloaded = false;
+    return GST_PAD_PROBE_OK;
+  }
+
+  // With the lock held. The branch is stopped before it leaves the
+  // pipeline, so none of the tile's probes runs once it is deleted.
+  std::vector<std::unique_ptr<rtvc::pipeline::tile>>::iterator
+  free_tile (std::vector<std::unique_ptr<rtvc::pipeline::tile>>::iterator it)
+  {
+    rtvc::pipeline::tile& tile = **it;
+    std::cout << "freeing tile " << tile.number << std::endl;
+    for (GstElement* element : tile.elements ())
+    {
+      gst_element_set_locked_state (element, TRUE);
+      gst_element_set_state (element, GST_STATE_NULL);
+    }
+    for (GstElement* element : tile.elements ())
+      gst_bin_remove (GST_BIN (pipeline), element);
+    gst_element_release_request_pad (compositor, tile.mixer_pad);
+    gst_object_unref (tile.mixer_pad);
+    return tiles.erase (it);
+  }
+
+  unsigned int active_unlocked () const
+  {
+    unsigned int count = 0;
+    for (auto&& tile : tiles)
+      count += tile->in_use;
+    return count;
+  }
+
+  // Grid with as many columns as rows, or one more
+  void layout ()
+  {
+    unsigned int count = active_unlocked ();
+    if (!count)
+      return;
+    unsigned int columns = std::ceil (std::sqrt (count));
+    unsigned int rows = (count + columns - 1) / columns;
+    int tile_width = width / columns, tile_height = height / rows;
+    unsigned int i = 0;
+    for (auto&& tile : tiles)
+      if (tile->in_use)
+      {
+        tile->resize ((i % columns) * tile_width, (i / columns) * tile_height, tile_width, tile_height);
+        ++i;
+      }
   }
 };
-    
+
 } }
 
 #endif
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_VIDEO_NAL_HPP
+#define RTVC_VIDEO_NAL_HPP
+
+#include <gst/gst.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace rtvc { namespace video {
+
+enum class codec { other, h264, h265 };
+
+// H.264 or H.265 in Annex B byte-stream, else other
+inline video::codec codec_from_caps (GstCaps* caps)
+{
+  if (!caps || gst_caps_is_empty (caps))
+    return codec::other;
+  GstStructure const* s = gst_caps_get_structure (caps, 0);
+  char const* format = gst_structure_get_string (s, "stream-format");
+  if (format && std::strcmp (format, "byte-stream"))
+    return codec::other;
+  if (gst_structure_has_name (s, "video/x-h264"))
+    return codec::h264;
+  if (gst_structure_has_name (s, "video/x-h265"))
+    return codec::h265;
+  return codec::other;
+}
+
+// Whether the access unit is a picture nothing else is predicted
+// from, so it can be dropped before decoding without breaking the
+// ones after it. Only the header of the first slice is looked at:
+// every slice of a picture agrees on it. With H.265 this holds for
+// streams of a single temporal layer, which is what cameras send.
+inline bool non_reference (video::codec codec, std::uint8_t const* data, std::size_t size)
+{
+  if (codec == codec::other)
+    return false;
+  for (std::size_t i = 0; i + 3 < size; ++i)
+  {
+    if (data[i] || data[i + 1] || data[i + 2] != 1)
+      continue;
+    std::uint8_t header = data[i + 3];
+    i += 3;
+    if (codec == codec::h264)
+    {
+      unsigned int type = header & 0x1f;
+      if (type == 1 || type == 5)
+        return !(header & 0x60);
+    }
+    else
+    {
+      unsigned int type = (header >> 1) & 0x3f;
+      // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved
+      // non-reference types are the even ones up to 14
+      if (type <= 31)
+        return type <= 14 && !(type & 1);
+    }
+  }
+  return false;
+}
+
+} }
+
+#endif
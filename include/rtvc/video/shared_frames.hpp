@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#ifndef RTVC_VIDEO_SHARED_FRAMES_HPP
+#define RTVC_VIDEO_SHARED_FRAMES_HPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+// Layout of the POSIX shared memory a channel's decoded and scaled
+// frames are published into, and the reader side of it. Only this
+// header is needed by a client, it doesn't depend on GStreamer.
+//
+// The region is a header followed by slots, each a frame descriptor
+// and the frame itself. The writer goes round the slots and never
+// waits for anyone: each slot is guarded by a sequence, odd while it
+// is written, so a reader sees whether the frame changed under it.
+// Readers map the frames for reading only and keep their own
+// position, so a client that stalls only loses frames of its own.
+//
+// The only thing readers write is when they last polled. Frames are
+// only published while someone polled in the last two seconds, and
+// the region is sparse until then, so a channel nobody reads takes no
+// memory.
+namespace rtvc { namespace video {
+
+constexpr std::uint32_t shared_frames_magic = 0x52545646; // RTVF
+constexpr std::uint32_t shared_frames_version = 2;
+
+// is_always_lock_free is C++17, clients may be built as C++11
+static_assert (ATOMIC_LLONG_LOCK_FREE == 2 && sizeof (long long) == sizeof (std::uint64_t)
+               , "shared sequences must be lock free");
+
+struct shared_frames_header
+{
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t slots;
+  std::uint32_t reserved;
+  // From the start of one slot to the next, descriptor included
+  std::uint64_t slot_size;
+  // Bytes a frame may take
+  std::uint64_t capacity;
+  // Frames published so far, the last one is in slot (published - 1) % slots
+  std::atomic<std::uint64_t> published;
+  // CLOCK_MONOTONIC time a reader last polled, in nanoseconds
+  std::atomic<std::uint64_t> polled;
+};
+
+constexpr std::uint64_t shared_frames_poll_timeout = 2000000000;
+
+inline std::uint64_t shared_frames_now ()
+{
+  timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return static_cast<std::uint64_t> (now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+struct shared_frame
+{
+  // 2 * frame + 1 while written, 2 * frame + 2 once published
+  std::atomic<std::uint64_t> sequence;
+  // Of the source, and monotonic time it was published at, in nanoseconds
+  std::uint64_t timestamp;
+  std::uint64_t published;
+  std::int32_t width, height;
+  // GStreamer video format name, e.g. I420
+  char format[16];
+  std::uint32_t planes;
+  std::uint32_t reserved;
+  std::uint64_t offset[4];
+  std::int32_t stride[4];
+  std::uint64_t size;
+};
+
+// The header and each descriptor take a block, frame data starts a
+// block into its slot
+constexpr std::size_t shared_frames_block = 256;
+static_assert (sizeof (shared_frames_header) <= shared_frames_block, "header too big");
+static_assert (sizeof (shared_frame) <= shared_frames_block, "frame descriptor too big");
+
+inline std::size_t shared_frames_size (std::size_t slots, std::size_t slot_size)
+{
+  return shared_frames_block + slots * slot_size;
+}
+
+inline shared_frame* shared_frame_slot (shared_frames_header* header, std::uint64_t index)
+{
+  return reinterpret_cast<shared_frame*>(reinterpret_cast<std::uint8_t*>(header) + shared_frames_block
+                                         + (index % header->slots) * header->slot_size);
+}
+
+// Attaches to the frames of a channel by name, e.g. /rtvc-host_37777_1
+struct shared_frames_reader
+{
+  shared_frames_header* header;
+  std::size_t size;
+  // The header alone, mapped writable to tell when this reader polled
+  shared_frames_header* control;
+  // Next frame this reader wants
+  std::uint64_t next;
+
+  shared_frames_reader (std::string const& name)
+    : header (nullptr), size (0), control (nullptr), next (0)
+  {
+    int fd = shm_open (name.c_str (), O_RDWR, 0);
+    if (fd < 0)
+      throw std::runtime_error ("Couldn't open shared frames " + name);
+    struct stat st;
+    if (fstat (fd, &st) < 0 || static_cast<std::size_t> (st.st_size) < shared_frames_block)
+    {
+      close (fd);
+      throw std::runtime_error ("Shared frames " + name + " are not ready");
+    }
+    size = st.st_size;
+    void* map = mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    void* control_map = mmap (nullptr, shared_frames_block, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED || control_map == MAP_FAILED)
+    {
+      if (map != MAP_FAILED)
+        munmap (map, size);
+      if (control_map != MAP_FAILED)
+        munmap (control_map, shared_frames_block);
+      throw std::runtime_error ("Couldn't map shared frames " + name);
+    }
+    header = static_cast<shared_frames_header*>(map);
+    control = static_cast<shared_frames_header*>(control_map);
+    if (header->magic != shared_frames_magic || header->version != shared_frames_version
+        || shared_frames_size (header->slots, header->slot_size) > size)
+    {
+      munmap (map, size);
+      munmap (control_map, shared_frames_block);
+      throw std::runtime_error ("Shared frames " + name + " have an unknown layout");
+    }
+    control->polled.store (shared_frames_now (), std::memory_order_relaxed);
+    next = header->published.load (std::memory_order_acquire);
+  }
+  ~shared_frames_reader ()
+  {
+    munmap (control, shared_frames_block);
+    munmap (header, size);
+  }
+
+  shared_frames_reader (shared_frames_reader const&) = delete;
+  shared_frames_reader& operator=(shared_frames_reader const&) = delete;
+
+  // Calls f (frame, data) with the oldest frame not yet read that is
+  // still there, in place. Returns false without calling f if there
+  // is none, or if the frame was overwritten meanwhile, in which case
+  // whatever f did with it must be thrown away. Frames keep coming as
+  // long as read is called at least every two seconds.
+  template <typename F>
+  bool read (F f)
+  {
+    control->polled.store (shared_frames_now (), std::memory_order_relaxed);
+    std::uint64_t published = header->published.load (std::memory_order_acquire);
+    if (next >= published)
+      return false;
+    // Fell behind, skip to the oldest frame still in the ring
+    if (published - next > header->slots)
+      next = published - header->slots;
+    shared_frame const* frame = shared_frame_slot (header, next);
+    std::uint64_t sequence = frame->sequence.load (std::memory_order_acquire);
+    if (sequence != 2 * next + 2)
+    {
+      ++next;
+      return false;
+    }
+    f (*frame, reinterpret_cast<std::uint8_t const*>(frame) + shared_frames_block);
+    std::atomic_thread_fence (std::memory_order_acquire);
+    bool valid = frame->sequence.load (std::memory_order_relaxed) == sequence;
+    ++next;
+    return valid;
+  }
+};
+
+} }
+
+#endif
@@ -4,49 +4,52 @@ awvapq1 channel=5 ! dmssdemux  latency=2000 name=d d.audio ! queue ! decodebin !
 esample ! audiomixer name=m ! autoaudiosink  dmsssrc host=nvr.localdomain user=admin password= port=57777 channel=13 ! dmssdemux name=d2 d2.audio
  ! queue ! decodebin ! queue ! audioconvert ! audiocheblimit mode=high-pass cutoff=400 ripple=0.2 ! audioresample ! m.
  */
-#include <rtvc/pipeline/source.hpp>
-#include <rtvc/pipeline/sound.hpp>
-#include <rtvc/pipeline/visualization.hpp>
+#include <rtvc/babysitter.hpp>
+#include <rtvc/config.hpp>
+#include <rtvc/metrics/exporter.hpp>
 
 #include <gst/gst.h>
-#include <gst/app/gstappsink.h>
-#include <gst/app/gstappsrc.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
 
 #include <stdio.h>
+#include <unistd.h>
 #include <iostream>
+#include <memory>
+#include <signal.h>
+#include <sstream>
 
 #include <boost/program_options.hpp>
-#include <boost/dynamic_bitset.hpp>
 
-#include <sys/wait.h>
-
-/* This function is called when an error message is posted on the bus */
+/* Called with each line read from stdin */
 template <typename F>
-static void error_cb (GstBus *bus, GstMessage *msg, void *data)
+static gboolean command_cb (GIOChannel *source, GIOCondition condition, gpointer data)
 {
-  (*static_cast<F*>(data)) (bus, msg);
+  gchar* line = nullptr;
+  GIOStatus status = g_io_channel_read_line (source, &line, nullptr, nullptr, nullptr);
+  if (status != G_IO_STATUS_NORMAL)
+    // stdin closed, e.g. running as a service
+    return status == G_IO_STATUS_AGAIN ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+  (*static_cast<F*>(data)) (line);
+  g_free (line);
+  return G_SOURCE_CONTINUE;
 }
 
-void turn_monitor_on ()
+/* Called on SIGHUP */
+template <typename F>
+static gboolean reload_signal_cb (gpointer data)
 {
-  char* argv[] = {"/usr/bin/xset", "dpms", "force", "on", NULL};
-  int status;
-  auto pid = fork();
-  if (!pid)
-    execve ("/usr/bin/xset",  argv, environ);
-  else
-    waitpid (pid, &status, 0);
+  (*static_cast<F*>(data)) ();
+  return G_SOURCE_CONTINUE;
 }
 
-void turn_monitor_off ()
+/* Called as the config file changes. Editors that save by renaming
+   over it show up as the file created anew. */
+template <typename F>
+static void config_changed_cb (GFileMonitor* monitor, GFile* file, GFile* other, GFileMonitorEvent event, gpointer data)
 {
-  char* argv[] = {"/usr/bin/xset", "dpms", "force", "off", NULL};
-  int status;
-  auto pid = fork();
-  if (!pid)
-    execve ("/usr/bin/xset",  argv, environ);
-  else
-    waitpid (pid, &status, 0);
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT || event == G_FILE_MONITOR_EVENT_CREATED)
+    (*static_cast<F*>(data)) ();
 }
 
 int
@@ -56,12 +59,12 @@ main (int   argc,
   guint major, minor, micro, nano;
 
   std::vector<std::string> hosts;
-  std::string host2, user, password;
   std::vector<int> ports;
-  std::vector<int> channels;
-  int port2;
-  unsigned int width = 1280, height = 720;
-  bool flip = false;
+  std::vector<int> channels_numbers;
+  rtvc::babysitter::settings config;
+  unsigned short metrics_port = 0;
+  std::vector<std::string> replays;
+  std::string config_path;
   
   {
     namespace po = boost::program_options;
@@ -78,28 +81,50 @@ main (int   argc,
       ("width", po::value<unsigned int>(), "Width of the Window")
       ("height", po::value<unsigned int>(), "Height of the Window")
       ("flip", "Flip image 90 degrees clockwise")
+      ("share-frames", "Publish the frames of shown channels to shared memory, as /rtvc-<source>, for local viewers")
+      ("display-fps", po::value<unsigned int>(), "Compose the window at this rate, skipping frames of faster sources")
+      ("metrics-port", po::value<unsigned short>(), "Serve Prometheus metrics on 127.0.0.1 at this port")
+      ("capture", po::value<std::string>(), "Record the demuxed streams of every source into this directory")
+      ("clips", po::value<std::string>(), "Write a clip of every trigger into this directory, starting before it")
+      ("pretrigger", po::value<unsigned int>(), "Seconds before a trigger clips start at, 10 by default")
+      ("pretrigger-bitrate", po::value<unsigned int>(), "Bitrate in kbit/s of the streams clips are cut from, 8192 for a main stream and 2048 for a substream by default")
+      ("cry-detect", "Only trigger on loud sounds that sound like an infant crying")
+      ("audio-latency", po::value<unsigned int>(), "Milliseconds from a source to the speakers to start with, 100 by default")
+      ("fixed-latency", "Keep the audio latency instead of following the jitter of the sources")
+      ("replay", po::value<std::vector<std::string>>()->multitoken(), "Replay captures as sources, instead of or next to NVRs")
+      ("replay-fast", "Replay as fast as possible instead of in real time")
+      ("config", po::value<std::string>(), "Read channels and their settings from this file, reloaded on SIGHUP or when it changes")
       ;
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);    
 
+    if (vm.count("replay")) replays = vm["replay"].as<std::vector<std::string>>();
+    if (vm.count("config")) config_path = vm["config"].as<std::string>();
+
     if (vm.count("help")
-        || !vm.count("host")
-        || !vm.count("port")
-        || !vm.count("user")
-        || !vm.count("pass")
-        || !vm.count("channel"))
+        || (replays.empty () && config_path.empty ()
+            && (!vm.count("host")
+                || !vm.count("port")
+                || !vm.count("user")
+                || !vm.count("pass")
+                || !vm.count("channel"))))
     {
       std::cout << desc << "\n";
       return 1;
     }
 
-    hosts = vm["host"].as<std::vector<std::string>>();
-    user = vm["user"].as<std::string>();
-    password = vm["pass"].as<std::string>();
-    ports = vm["port"].as<std::vector<int>>();
-    channels = vm["channel"].as<std::vector<int>>();
+    if (vm.count("host")) hosts = vm["host"].as<std::vector<std::string>>();
+    if (vm.count("user")) config.user = vm["user"].as<std::string>();
+    if (vm.count("pass")) config.password = vm["pass"].as<std::string>();
+    if (vm.count("port")) ports = vm["port"].as<std::vector<int>>();
+    if (vm.count("channel")) channels_numbers = vm["channel"].as<std::vector<int>>();
+    if (vm.count("failover-host"))
+    {
+      config.failover_host = vm["failover-host"].as<std::string>();
+      config.failover_port = vm.count("failover-port") ? vm["failover-port"].as<int>() : (ports.empty() ? 0 : ports.front());
+    }
 
     if (vm.count("compression")) {
       std::cout << "Compression level was set to " 
@@ -108,9 +133,20 @@ main (int   argc,
       std::cout << "Compression level was not set.\n";
     }
 
-    if (vm.count("width")) width = vm["width"].as<unsigned int>();
-    if (vm.count("height")) height = vm["height"].as<unsigned int>();
-    if (vm.count("flip")) flip = true;
+    if (vm.count("width")) config.width = vm["width"].as<unsigned int>();
+    if (vm.count("height")) config.height = vm["height"].as<unsigned int>();
+    if (vm.count("flip")) config.flip = true;
+    if (vm.count("share-frames")) config.share_frames = true;
+    if (vm.count("display-fps")) config.display_rate = vm["display-fps"].as<unsigned int>();
+    if (vm.count("metrics-port")) metrics_port = vm["metrics-port"].as<unsigned short>();
+    if (vm.count("capture")) config.capture_dir = vm["capture"].as<std::string>();
+    if (vm.count("clips")) config.clip_dir = vm["clips"].as<std::string>();
+    if (vm.count("pretrigger")) config.pretrigger_seconds = vm["pretrigger"].as<unsigned int>();
+    if (vm.count("pretrigger-bitrate")) config.pretrigger_bitrate = vm["pretrigger-bitrate"].as<unsigned int>();
+    if (vm.count("cry-detect")) config.cry_detection = true;
+    if (vm.count("audio-latency")) config.audio_latency = vm["audio-latency"].as<unsigned int>() * GST_MSECOND;
+    if (vm.count("fixed-latency")) config.adaptive_latency = false;
+    if (vm.count("replay-fast")) config.replay_fast = true;
   }
   
   gst_init (&argc, &argv);
@@ -120,211 +156,98 @@ main (int   argc,
   printf ("This program is linked against GStreamer %d.%d.%d\n",
           major, minor, micro);
 
-  std::cout << "window size " << width << "x" << height << std::endl;
+  std::cout << "window size " << config.width << "x" << config.height << std::endl;
   
-  std::vector<rtvc::pipeline::source> sources(hosts.size());
-  rtvc::pipeline::sound_sink sound_sink(hosts.size());
-  boost::dynamic_bitset<> sources_loaded(hosts.size());
-  boost::dynamic_bitset<> reset_caps(hosts.size());
-  std::vector<unsigned int> threshold_remaining(hosts.size());
-  std::unique_ptr<rtvc::pipeline::visualization> visualization;
+  rtvc::babysitter babysitter (config);
+  std::unique_ptr<rtvc::metrics::exporter> exporter;
+  if (metrics_port)
+    exporter.reset (new rtvc::metrics::exporter (babysitter.metrics, metrics_port));
+
+  // Channels of the command line, with default settings, are kept
+  // next to the ones of the config file, which win over them
+  std::map<rtvc::babysitter::channel_key, rtvc::channel_settings> command_line_channels;
   {
     unsigned int index = 0;
     for (auto&& host : hosts)
     {
-      std::cout << "initializing source" << std::endl;
-      sources[index] = std::move(rtvc::pipeline::source{host, ports[index], user, password, channels[index], 1});
-      sources[index].sample_signal.connect
-        (
-         [&,index] (GstSample* sample)
-         {
-           //std::cout << "appsink " << index << std::endl;
-           static GstClockTime timestamp_offset;
-
-           GstBuffer* buffer = gst_sample_get_buffer (sample);
-           assert (!!buffer);
-           assert (GST_IS_BUFFER (buffer));
-           if(!reset_caps[index])
-           {
-             timestamp_offset = GST_BUFFER_TIMESTAMP (buffer);
-             GstCaps* caps = gst_sample_get_caps (sample);
-
-             std::cout << "appsrc caps will be " << gst_caps_to_string (caps) << std::endl;
-         
-             gst_app_src_set_caps (GST_APP_SRC (sound_sink.appsrc[index]), caps);
-             //   gst_app_src_set_caps (GST_APP_SRC (motion_pipeline.appsrc), caps);
-             gst_caps_unref (caps);
-             reset_caps[index] = true;
-
-             GstBuffer* tmp = gst_buffer_copy (buffer);
-             assert (!!tmp);
-             assert (GST_IS_BUFFER (tmp));
-             //GstBuffer* tmp1 = gst_buffer_copy (buffer);
-             // gst_buffer_ref (tmp);
-             // gst_buffer_ref (buffer);
-             GST_BUFFER_TIMESTAMP (tmp) = 0;
-             //GST_BUFFER_TIMESTAMP (tmp1) = 0;
-             GstFlowReturn r;
-             if ((r = gst_app_src_push_buffer (GST_APP_SRC(sound_sink.appsrc[index]), tmp)) != GST_FLOW_OK)
-             {
-               std::cout << "Error with gst_app_src_push_buffer for view_pipeline, return " << r << std::endl;
-             }
-             sources_loaded[index] = true;
-
-             if (sources_loaded.none())
-             {
-               std::cout << "starting sound sink" << std::endl;
-               gst_element_set_state(sound_sink.pipeline, GST_STATE_PLAYING);
-             }
-             else
-             {
-               std::cout << "starting sound sink" << std::endl;
-               gst_element_set_state(sound_sink.pipeline, GST_STATE_READY);
-               gst_element_set_state(sound_sink.pipeline, GST_STATE_PLAYING);
-             }
-           }
-           else if (sources[index].current_level > -10. || threshold_remaining[index] != 0)
-           {
-             if (!visualization)
-             {
-               turn_monitor_on ();
-               visualization.reset (new rtvc::pipeline::visualization (width, height, flip));
-               std::shared_ptr<bool> set_caps (new bool{true});
-               sources[index].sample_video_signal.connect
-                 ([&, index, set_caps = std::move(set_caps)] (GstSample* sample)
-                  {
-                    //std::cout << "video sample" << std::endl;
-                    static GstClockTime timestamp_offset;
-
-                    GstBuffer* buffer = gst_sample_get_buffer (sample);
-                    assert (!!buffer);
-                    assert (GST_IS_BUFFER (buffer));
-                    if (*set_caps)
-                    {
-                      timestamp_offset = GST_BUFFER_TIMESTAMP (buffer);
-                      GstCaps* caps = gst_sample_get_caps (sample);
-
-                      std::cout << "video appsrc caps will be " << gst_caps_to_string (caps) << std::endl;
-         
-                      gst_app_src_set_caps (GST_APP_SRC (visualization->appsrc), caps);
-                      //   gst_app_src_set_caps (GST_APP_SRC (motion_pipeline.appsrc), caps);
-                      gst_caps_unref (caps);
-                      *set_caps = false;
-
-                      GstBuffer* tmp = gst_buffer_copy (buffer);
-                      assert (!!tmp);
-                      assert (GST_IS_BUFFER (tmp));
-                      GST_BUFFER_TIMESTAMP (tmp) = 0;
-                      GstFlowReturn r;
-                      if ((r = gst_app_src_push_buffer (GST_APP_SRC(visualization->appsrc), tmp)) != GST_FLOW_OK)
-                      {
-                        std::cout << "Error with gst_app_src_push_buffer for view_pipeline, return " << r << std::endl;
-                      }
-
-                      gst_element_set_state(visualization->pipeline, GST_STATE_READY);
-                      gst_element_set_state(visualization->pipeline, GST_STATE_PLAYING);
-                    }
-                    else
-                    {
-                      GstBuffer* tmp = gst_buffer_copy (buffer);
-                      assert (!!tmp);
-                      assert (GST_IS_BUFFER (tmp));
-                      GST_BUFFER_TIMESTAMP (tmp) -= timestamp_offset;
-                      GstFlowReturn r;
-                      if ((r = gst_app_src_push_buffer (GST_APP_SRC(visualization->appsrc), tmp)) != GST_FLOW_OK)
-                      {
-                        std::cout << "Error with gst_app_src_push_buffer for view_pipeline, return " << r << std::endl;
-                      }
-                    }
-                  });
-             }
-             
-             if (threshold_remaining[index] == 0)
-               threshold_remaining[index] = 500;
-             else
-             {
-               if (--threshold_remaining[index] == 0)
-               {
-                 std::cout << "Reached 0, stopping video" << std::endl;
-                 sources[index].sample_video_signal.disconnect_all_slots ();
-                 gst_element_set_state (visualization->pipeline, GST_STATE_NULL);
-                 visualization.reset();
-                 turn_monitor_off();
-               }
-             }
-             //std::cout << "volume above threshold, pushing" << std::endl;
-             // std::cout << "sending buffer" << std::endl;
-             GstBuffer* tmp = gst_buffer_copy (buffer);
-             //GstBuffer* tmp1 = gst_buffer_copy (buffer);
-             // gst_buffer_ref (tmp);
-             // gst_buffer_ref (buffer);
-             assert (!!tmp);
-             assert (GST_IS_BUFFER (tmp));
-             GST_BUFFER_TIMESTAMP (tmp) -= timestamp_offset;
-             //GST_BUFFER_TIMESTAMP (tmp1) -= timestamp_offset;
-             GstFlowReturn r;
-             if ((r = gst_app_src_push_buffer (GST_APP_SRC(sound_sink.appsrc[index]), tmp)) != GST_FLOW_OK)
-             {
-               std::cout << "Error with gst_app_src_push_buffer for sound_sink, return " << r << std::endl;
-             }
-           }
-         }
-         );
+      command_line_channels.emplace (rtvc::babysitter::channel_key (host, ports[index], channels_numbers[index])
+                                     , rtvc::channel_settings ());
       ++index;
     }
-
+    rtvc::channel_settings replay_settings;
+    replay_settings.replay = true;
+    for (auto&& replay : replays)
+      command_line_channels.emplace (rtvc::babysitter::channel_key (replay, 0, 0), replay_settings);
   }
 
-  gst_pipeline_set_latency(GST_PIPELINE(sound_sink.pipeline), GST_SECOND);
-
-  for (auto&& source : sources)
+  // Applies the config file as it is now. Only channels whose
+  // settings changed are touched, and a file that doesn't read keeps
+  // the channels running as they are.
+  auto reload = [&] () -> bool
+    {
+      std::map<rtvc::babysitter::channel_key, rtvc::channel_settings> wanted;
+      if (!config_path.empty ())
+      {
+        try
+        {
+          wanted = rtvc::read_channels (config_path);
+        }
+        catch (std::exception const& e)
+        {
+          std::cout << "config not applied, " << e.what () << std::endl;
+          return false;
+        }
+        std::cout << "applying config " << config_path << std::endl;
+      }
+      wanted.insert (command_line_channels.begin (), command_line_channels.end ());
+      babysitter.reconfigure (wanted);
+      return true;
+    };
+  if (!reload ())
+    return 1;
+
+  typedef decltype(reload) reload_type;
+  GFileMonitor* config_monitor = nullptr;
+  if (!config_path.empty ())
   {
-    gst_element_set_state(source.pipeline, GST_STATE_READY);
+    g_unix_signal_add (SIGHUP, &reload_signal_cb<reload_type>, &reload);
+    GFile* file = g_file_new_for_path (config_path.c_str ());
+    GError* error = nullptr;
+    config_monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, nullptr, &error);
+    g_object_unref (file);
+    if (config_monitor)
+      g_signal_connect (config_monitor, "changed", G_CALLBACK (&config_changed_cb<reload_type>), &reload);
+    else
+    {
+      // SIGHUP still reloads it
+      std::cout << "not watching " << config_path << ": " << error->message << std::endl;
+      g_error_free (error);
+    }
   }
-  gst_element_set_state(sound_sink.pipeline, GST_STATE_READY);
-
-  GMainLoop* main_loop = g_main_loop_new (NULL, FALSE);
-
-  unsigned int index = 0;
-  for (auto&& source : sources)
-  {
-    gst_element_set_state (source.pipeline, GST_STATE_PLAYING);
-    GstBus* bus = gst_element_get_bus (source.pipeline);
-    gst_bus_add_signal_watch (bus);
-
-    GError *err;
-    gchar *debug_info;
 
-    /* Print error details on the screen */
-    auto error_callback = [&,index] (GstBus *bus, GstMessage *msg)
-     {
-       gst_message_parse_error (msg, &err, &debug_info);
-       g_printerr ("Error received from element %s: %s\n", GST_OBJECT_NAME (msg->src), err->message);
-       g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
-       
-       if (!strcmp(GST_OBJECT_NAME(msg->src), "dmsssrc"))
-       {
-         std::cout << "Error happened in dmsssrc" << std::endl;
-
-         gst_element_set_state(sound_sink.pipeline, GST_STATE_PAUSED);
-         reset_caps[index] = false;
-         gst_element_set_state(sources[index].pipeline, GST_STATE_READY);
-         gst_element_set_state(sources[index].pipeline, GST_STATE_PLAYING);
-         //gst_element_set_state(sound_sink.pipeline, GST_STATE_PLAYING);
-       }
-  
-       g_clear_error (&err);
-       g_free (debug_info);
-  
-       // g_main_loop_quit (data->main_loop);
-     };
-
-    typedef decltype(error_callback) error_callback_type;
-    g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb<error_callback_type>, new error_callback_type(error_callback));
-    gst_object_unref (GST_OBJECT (bus));
-    ++index;
-  }
+  // Channels are added and removed at runtime with lines on stdin:
+  // add <host> <port> <channel>
+  // remove <host> <port> <channel>
+  // Reloads of the config file leave them alone, unless it lists them.
+  auto command_callback = [&] (std::string const& line)
+    {
+      std::istringstream stream (line);
+      std::string command, host;
+      int port, number;
+      if (!(stream >> command >> host >> port >> number))
+        std::cout << "usage: add|remove <host> <port> <channel>" << std::endl;
+      else if (command == "add")
+        babysitter.add_channel (host, port, number);
+      else if (command == "remove")
+        babysitter.remove_channel (host, port, number);
+      else
+        std::cout << "unknown command " << command << std::endl;
+    };
+  typedef decltype(command_callback) command_callback_type;
+  GIOChannel* input = g_io_channel_unix_new (STDIN_FILENO);
+  g_io_add_watch (input, GIOCondition (G_IO_IN | G_IO_HUP), &command_cb<command_callback_type>, &command_callback);
 
+  GMainLoop* main_loop = g_main_loop_new (NULL, FALSE);
   
   g_main_loop_run (main_loop);
  
@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#define BOOST_TEST_MODULE clock_mapping
+#include <boost/test/included/unit_test.hpp>
+
+#include <rtvc/pipeline/clock_mapping.hpp>
+
+using rtvc::pipeline::clock_mapping;
+
+namespace {
+
+// Monotonic time the mapping starts at, in microseconds
+gint64 const start = 1000000000;
+
+struct fixture
+{
+  rtvc::metrics::ingress_times times;
+  clock_mapping mapping;
+
+  fixture () { gst_init (nullptr, nullptr); }
+
+  // A buffer of timestamp that left the demuxer at arrival, both in
+  // nanoseconds from the start
+  void observe (GstClockTime timestamp, GstClockTime arrival, unsigned int connection = 1)
+  {
+    GstBuffer* buffer = gst_buffer_new ();
+    GST_BUFFER_PTS (buffer) = timestamp;
+    times.stamp (buffer, start + static_cast<gint64> (arrival / GST_USECOND));
+    mapping.observe (buffer, connection, times);
+    gst_buffer_unref (buffer);
+  }
+
+  gint64 offset () const
+  {
+    return mapping.offset - start * static_cast<gint64> (GST_USECOND);
+  }
+};
+
+}
+
+BOOST_FIXTURE_TEST_CASE (first_buffer_maps, fixture)
+{
+  BOOST_CHECK (!mapping.mapped);
+  observe (10 * GST_SECOND, 10 * GST_SECOND + 50 * GST_MSECOND);
+  BOOST_CHECK (mapping.mapped);
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (50 * GST_MSECOND));
+}
+
+BOOST_FIXTURE_TEST_CASE (earlier_arrival_moves_down_at_once, fixture)
+{
+  observe (0, 50 * GST_MSECOND);
+  observe (20 * GST_MSECOND, 40 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (20 * GST_MSECOND));
+}
+
+BOOST_FIXTURE_TEST_CASE (late_burst_barely_moves, fixture)
+{
+  observe (0, 20 * GST_MSECOND);
+  // Half a second late, 20 ms of timestamps later: creeps by 4 us
+  observe (20 * GST_MSECOND, 540 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (20 * GST_MSECOND + 4 * GST_USECOND));
+  observe (40 * GST_MSECOND, 60 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (20 * GST_MSECOND));
+}
+
+BOOST_FIXTURE_TEST_CASE (jump_maps_anew, fixture)
+{
+  observe (0, 20 * GST_MSECOND);
+  observe (20 * GST_MSECOND, 2 * GST_SECOND);
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (2 * GST_SECOND - 20 * GST_MSECOND));
+  BOOST_CHECK_EQUAL (mapping.first, 20 * GST_MSECOND);
+}
+
+BOOST_FIXTURE_TEST_CASE (new_connection_maps_anew, fixture)
+{
+  observe (0, 500 * GST_MSECOND, 1);
+  // Later, which only a new mapping takes at once
+  observe (0, 700 * GST_MSECOND, 2);
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (700 * GST_MSECOND));
+  BOOST_CHECK_EQUAL (mapping.connection, 2u);
+}
+
+BOOST_FIXTURE_TEST_CASE (only_mapping_anew_bumps_epoch, fixture)
+{
+  observe (0, 50 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (mapping.epoch, 1u);
+  observe (20 * GST_MSECOND, 40 * GST_MSECOND);
+  observe (40 * GST_MSECOND, 540 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (mapping.epoch, 1u);
+  observe (60 * GST_MSECOND, 2 * GST_SECOND);
+  BOOST_CHECK_EQUAL (mapping.epoch, 2u);
+  observe (0, 0, 2);
+  BOOST_CHECK_EQUAL (mapping.epoch, 3u);
+}
+
+BOOST_FIXTURE_TEST_CASE (slower_source_is_followed, fixture)
+{
+  // 100 ppm slower than ours, a buffer a second for a minute
+  for (unsigned int i = 0; i <= 60; ++i)
+    observe (i * GST_SECOND, i * (GST_SECOND + 100 * GST_USECOND));
+  BOOST_CHECK_EQUAL (offset (), static_cast<gint64> (6 * GST_MSECOND));
+  BOOST_CHECK_CLOSE (mapping.drift (), -100., 0.1);
+}
+
+BOOST_FIXTURE_TEST_CASE (invalid_timestamp_is_ignored, fixture)
+{
+  observe (GST_CLOCK_TIME_NONE, 0);
+  BOOST_CHECK (!mapping.mapped);
+}
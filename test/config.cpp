@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#define BOOST_TEST_MODULE config
+#include <boost/test/included/unit_test.hpp>
+
+#include <rtvc/config.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+#include <unistd.h>
+
+namespace {
+
+// An INI file of contents, removed with it
+struct file
+{
+  std::string path;
+
+  file (std::string const& contents)
+  {
+    char name[] = "/tmp/rtvc-config-XXXXXX";
+    int fd = mkstemp (name);
+    if (fd < 0)
+      throw std::runtime_error ("mkstemp failed");
+    close (fd);
+    path = name;
+    std::ofstream (path) << contents;
+  }
+  ~file ()
+  {
+    std::remove (path.c_str ());
+  }
+};
+
+std::map<rtvc::babysitter::channel_key, rtvc::channel_settings> read (std::string const& contents)
+{
+  file f (contents);
+  return rtvc::read_channels (f.path);
+}
+
+// The error read throws, without the path it starts with
+std::string error (std::string const& contents)
+{
+  file f (contents);
+  try
+  {
+    rtvc::read_channels (f.path);
+  }
+  catch (std::runtime_error const& e)
+  {
+    std::string what = e.what ();
+    BOOST_CHECK_EQUAL (what.substr (0, f.path.size () + 2), f.path + ": ");
+    return what.substr (f.path.size () + 2);
+  }
+  BOOST_ERROR ("no error for " << contents);
+  return {};
+}
+
+}
+
+BOOST_AUTO_TEST_CASE (defaults)
+{
+  auto channels = read ("[nursery]\nhost = nvr.localdomain\nport = 37777\nchannel = 5\n");
+  BOOST_REQUIRE_EQUAL (channels.size (), 1u);
+  auto&& channel = *channels.begin ();
+  BOOST_CHECK (channel.first == rtvc::babysitter::channel_key ("nvr.localdomain", 37777, 5));
+  BOOST_CHECK (channel.second == rtvc::channel_settings ());
+  BOOST_CHECK_EQUAL (channel.second.hysteresis, 20000u);
+}
+
+BOOST_AUTO_TEST_CASE (every_setting)
+{
+  auto channels = read ("[nursery]\nhost = nvr\nport = 37777\nchannel = 5\n"
+                        "stream = 0\nthreshold = -20.5\nhysteresis = 1500\ngain = 2\npriority = 3\n"
+                        "[capture]\nreplay = /var/captures/nursery.rtvc\n");
+  BOOST_REQUIRE_EQUAL (channels.size (), 2u);
+
+  rtvc::channel_settings const& nursery = channels.at (rtvc::babysitter::channel_key ("nvr", 37777, 5));
+  BOOST_CHECK (!nursery.replay);
+  BOOST_CHECK_EQUAL (nursery.stream, 0);
+  BOOST_CHECK_EQUAL (nursery.threshold, -20.5);
+  // Milliseconds
+  BOOST_CHECK_EQUAL (nursery.hysteresis, 1500u);
+  BOOST_CHECK_EQUAL (nursery.gain, 2.);
+  BOOST_CHECK_EQUAL (nursery.priority, 3);
+
+  rtvc::channel_settings const& capture
+    = channels.at (rtvc::babysitter::channel_key ("/var/captures/nursery.rtvc", 0, 0));
+  BOOST_CHECK (capture.replay);
+  BOOST_CHECK_EQUAL (capture.stream, 1);
+}
+
+BOOST_AUTO_TEST_CASE (empty_file)
+{
+  BOOST_CHECK (read ("").empty ());
+}
+
+BOOST_AUTO_TEST_CASE (errors)
+{
+  std::string const channel = "[c]\nhost = nvr\nport = 37777\nchannel = 5\n";
+  BOOST_CHECK_EQUAL (error (channel + "stream = 2\n"), "stream of c must be 0 or 1");
+  BOOST_CHECK_EQUAL (error ("[c]\nreplay = x\nstream = 0\n"), "replay c only has the substream");
+  BOOST_CHECK_EQUAL (error (channel + "threshold = 3\n"), "threshold of c must be in dBFS, at most 0");
+  BOOST_CHECK_EQUAL (error (channel + "hysteresis = 0\n"), "hysteresis of c must be at least 1 ms");
+  BOOST_CHECK_EQUAL (error (channel + "hysteresis = -1\n"), "hysteresis of c must be at least 1 ms");
+  BOOST_CHECK_EQUAL (error (channel + "gain = 11\n"), "gain of c must be between 0 and 10");
+  BOOST_CHECK_EQUAL (error (channel + "[d]\nhost = nvr\nport = 37777\nchannel = 5\n")
+                     , "channel of d is already in the file");
+  // Missing keys, bad values and bad syntax come from property_tree
+  error ("[c]\nhost = nvr\nport = 37777\n");
+  error (channel + "port = x\n");
+  error (channel + "threshold = loud\n");
+  error (channel + "stream = 1.5\n");
+  error ("[c\nhost = nvr\n");
+}
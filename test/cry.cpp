@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#define BOOST_TEST_MODULE cry
+#include <boost/test/included/unit_test.hpp>
+
+#include <rtvc/audio/cry.hpp>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using rtvc::audio::cry_classifier;
+
+namespace {
+
+unsigned int const rate = 8000;
+
+// Harmonics of fundamental, up to 3 kHz, at about -12 dBFS
+std::vector<float> voiced (double fundamental, double seconds)
+{
+  std::vector<float> samples (static_cast<std::size_t> (seconds * rate));
+  for (std::size_t i = 0; i != samples.size (); ++i)
+  {
+    double t = static_cast<double> (i) / rate;
+    double value = 0.;
+    for (unsigned int h = 1; h * fundamental < 3000.; ++h)
+      value += std::sin (2. * M_PI * h * fundamental * t) / h;
+    samples[i] = static_cast<float> (0.25 * value);
+  }
+  return samples;
+}
+
+std::vector<float> noise (double seconds)
+{
+  std::mt19937 random (1);
+  std::uniform_real_distribution<float> distribution (-0.25f, 0.25f);
+  std::vector<float> samples (static_cast<std::size_t> (seconds * rate));
+  for (auto&& s : samples)
+    s = distribution (random);
+  return samples;
+}
+
+std::vector<float> silence (double seconds)
+{
+  return std::vector<float> (static_cast<std::size_t> (seconds * rate));
+}
+
+void add (cry_classifier& c, std::vector<float> const& samples)
+{
+  c.add_f32 (samples.data (), samples.size (), 1);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE (cry_scores_high)
+{
+  cry_classifier c (rate);
+  add (c, voiced (450., 2.));
+  BOOST_CHECK_GT (c.score (), 0.9);
+  BOOST_CHECK (c.onset ());
+}
+
+BOOST_AUTO_TEST_CASE (adult_voice_scores_low)
+{
+  cry_classifier c (rate);
+  add (c, voiced (120., 2.));
+  BOOST_CHECK_LT (c.score (), 0.4);
+  BOOST_CHECK (!c.onset ());
+}
+
+BOOST_AUTO_TEST_CASE (noise_scores_low)
+{
+  cry_classifier c (rate);
+  add (c, noise (2.));
+  BOOST_CHECK_LT (c.score (), 0.4);
+  BOOST_CHECK (!c.onset ());
+}
+
+BOOST_AUTO_TEST_CASE (silence_scores_zero)
+{
+  cry_classifier c (rate);
+  add (c, silence (2.));
+  BOOST_CHECK_EQUAL (c.score (), 0.);
+  BOOST_CHECK (!c.onset ());
+}
+
+BOOST_AUTO_TEST_CASE (s16_matches_f32)
+{
+  std::vector<float> samples = voiced (450., 1.);
+  // Stereo, the second channel being ignored
+  std::vector<std::int16_t> interleaved;
+  for (float s : samples)
+  {
+    interleaved.push_back (static_cast<std::int16_t> (s * 32767.f));
+    interleaved.push_back (0);
+  }
+  cry_classifier f32 (rate), s16 (rate);
+  add (f32, samples);
+  s16.add_s16 (interleaved.data (), samples.size (), 2);
+  BOOST_CHECK_EQUAL (f32.score (), s16.score ());
+}
+
+// A cry after quiet is told by the onset well before the score
+BOOST_AUTO_TEST_CASE (onset_before_score)
+{
+  cry_classifier c (rate);
+  add (c, silence (1.));
+  std::vector<float> cry = voiced (450., 1.);
+  std::size_t fed = 0;
+  for (; fed != cry.size () && !c.onset (); fed += c.hop)
+    c.add_f32 (cry.data () + fed, c.hop, 1);
+  BOOST_CHECK (c.onset ());
+  BOOST_CHECK_LE (fed, 0.2 * rate);
+  BOOST_CHECK_LT (c.score (), 0.4);
+
+  // And is over as soon as the cry is
+  add (c, noise (0.2));
+  BOOST_CHECK (!c.onset ());
+}
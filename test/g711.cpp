@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#define BOOST_TEST_MODULE g711
+#include <boost/test/included/unit_test.hpp>
+
+#include <rtvc/audio/g711.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace g711 = rtvc::audio::g711;
+
+BOOST_AUTO_TEST_CASE (alaw_table)
+{
+  g711::table const& t = g711::table::alaw ();
+  // Smallest and largest magnitudes of either sign
+  BOOST_CHECK_EQUAL (t.linear[0xd5], 8);
+  BOOST_CHECK_EQUAL (t.linear[0x55], -8);
+  BOOST_CHECK_EQUAL (t.linear[0xaa], 32256);
+  BOOST_CHECK_EQUAL (t.linear[0x2a], -32256);
+}
+
+BOOST_AUTO_TEST_CASE (mulaw_table)
+{
+  g711::table const& t = g711::table::mulaw ();
+  BOOST_CHECK_EQUAL (t.linear[0xff], 0);
+  BOOST_CHECK_EQUAL (t.linear[0x7f], 0);
+  BOOST_CHECK_EQUAL (t.linear[0x80], 32124);
+  BOOST_CHECK_EQUAL (t.linear[0x00], -32124);
+}
+
+BOOST_AUTO_TEST_CASE (tables_are_odd)
+{
+  // Flipping the sign bit negates the sample
+  for (unsigned int i = 0; i != 128; ++i)
+  {
+    BOOST_CHECK_EQUAL (g711::table::alaw ().linear[i], -g711::table::alaw ().linear[i ^ 0x80]);
+    BOOST_CHECK_EQUAL (g711::table::mulaw ().linear[i], -g711::table::mulaw ().linear[i ^ 0x80]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE (level_matches_decoded)
+{
+  // More than one block of 256
+  std::vector<std::uint8_t> bytes (1000);
+  for (std::size_t i = 0; i != bytes.size (); ++i)
+    bytes[i] = static_cast<std::uint8_t> (i * 37);
+  for (g711::table const* t : {&g711::table::alaw (), &g711::table::mulaw ()})
+  {
+    std::vector<std::int16_t> samples (bytes.size ());
+    t->decode (bytes.data (), samples.data (), bytes.size ());
+    rtvc::audio::level_accumulator accumulator;
+    accumulator.add_s16 (samples.data (), samples.size ());
+    rtvc::audio::level expected = accumulator.level ();
+
+    rtvc::audio::level level = g711::level (*t, bytes.data (), bytes.size ());
+    BOOST_CHECK_CLOSE (level.rms, expected.rms, 1e-9);
+    BOOST_CHECK_CLOSE (level.peak, expected.peak, 1e-9);
+  }
+}
+
+BOOST_AUTO_TEST_CASE (level_of_silence)
+{
+  std::vector<std::uint8_t> bytes (160, 0xff);
+  rtvc::audio::level level = g711::level (g711::table::mulaw (), bytes.data (), bytes.size ());
+  BOOST_CHECK (std::isinf (level.rms) && level.rms < 0.);
+  BOOST_CHECK (std::isinf (level.peak) && level.peak < 0.);
+}
+
+BOOST_AUTO_TEST_CASE (from_caps)
+{
+  gst_init (nullptr, nullptr);
+  GstCaps* alaw = gst_caps_from_string ("audio/x-alaw, rate=8000, channels=1");
+  GstCaps* mulaw = gst_caps_from_string ("audio/x-mulaw, rate=8000, channels=1");
+  GstCaps* raw = gst_caps_from_string ("audio/x-raw, format=S16LE");
+  BOOST_CHECK (g711::table::from_caps (alaw) == &g711::table::alaw ());
+  BOOST_CHECK (g711::table::from_caps (mulaw) == &g711::table::mulaw ());
+  BOOST_CHECK (!g711::table::from_caps (raw));
+  BOOST_CHECK (!g711::table::from_caps (nullptr));
+  gst_caps_unref (alaw);
+  gst_caps_unref (mulaw);
+  gst_caps_unref (raw);
+}
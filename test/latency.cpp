@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#define BOOST_TEST_MODULE latency
+#include <boost/test/included/unit_test.hpp>
+
+#include <rtvc/pipeline/latency.hpp>
+
+#include <vector>
+
+using rtvc::pipeline::jitter;
+using rtvc::pipeline::latency_controller;
+
+BOOST_AUTO_TEST_CASE (jitter_percentile)
+{
+  jitter j (100);
+  std::vector<gint64> scratch;
+  BOOST_CHECK_EQUAL (j.measure (0.99, scratch), 0);
+  for (gint64 i = 1; i <= 100; ++i)
+    j.add (i * GST_MSECOND, 50 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (j.measure (0.99, scratch), static_cast<gint64> (100 * GST_MSECOND));
+  BOOST_CHECK_EQUAL (j.measure (0.5, scratch), static_cast<gint64> (51 * GST_MSECOND));
+  BOOST_CHECK_EQUAL (j.percentile.load (), static_cast<gint64> (51 * GST_MSECOND));
+  // Later than the wait
+  BOOST_CHECK_EQUAL (j.underruns.load (), 50u);
+}
+
+BOOST_AUTO_TEST_CASE (jitter_window)
+{
+  jitter j (10);
+  std::vector<gint64> scratch;
+  for (int i = 0; i != 10; ++i)
+    j.add (GST_SECOND, GST_SECOND);
+  // Only the last ten count
+  for (int i = 0; i != 10; ++i)
+    j.add (GST_MSECOND, GST_SECOND);
+  BOOST_CHECK_EQUAL (j.measure (0.99, scratch), static_cast<gint64> (GST_MSECOND));
+  BOOST_CHECK_EQUAL (j.underruns.load (), 0u);
+}
+
+namespace {
+
+struct fixture
+{
+  latency_controller controller;
+  std::shared_ptr<jitter> j;
+  std::vector<GstClockTime> applied;
+  gint64 now;
+
+  fixture ()
+    : controller (50 * GST_MSECOND), j (std::make_shared<jitter> (10)), now (0)
+  {
+    controller.add (j);
+  }
+
+  // Every buffer of the window as late, then an interval later an update
+  void update (GstClockTime lateness)
+  {
+    for (int i = 0; i != 10; ++i)
+      j->add (lateness, controller.wait);
+    now += controller.interval;
+    controller.update (now, [this] (GstClockTime wait) { applied.push_back (wait); });
+  }
+};
+
+}
+
+BOOST_FIXTURE_TEST_CASE (longer_wait_at_once, fixture)
+{
+  update (100 * GST_MSECOND);
+  BOOST_REQUIRE_EQUAL (applied.size (), 1u);
+  BOOST_CHECK_EQUAL (applied[0], 110 * GST_MSECOND);
+  BOOST_CHECK_EQUAL (controller.wait.load (), 110 * GST_MSECOND);
+}
+
+BOOST_FIXTURE_TEST_CASE (wait_is_bounded, fixture)
+{
+  update (5 * GST_SECOND);
+  BOOST_REQUIRE_EQUAL (applied.size (), 1u);
+  BOOST_CHECK_EQUAL (applied[0], controller.maximum);
+}
+
+BOOST_FIXTURE_TEST_CASE (shorter_wait_after_hold, fixture)
+{
+  // 20 ms floor, held for ten seconds before it is taken
+  for (int i = 0; i != 10; ++i)
+    update (0);
+  BOOST_CHECK (applied.empty ());
+  update (0);
+  BOOST_REQUIRE_EQUAL (applied.size (), 1u);
+  BOOST_CHECK_EQUAL (applied[0], controller.minimum);
+}
+
+BOOST_FIXTURE_TEST_CASE (longer_need_resets_hold, fixture)
+{
+  for (int i = 0; i != 8; ++i)
+    update (0);
+  // Within a margin of the current wait
+  update (35 * GST_MSECOND);
+  for (int i = 0; i != 8; ++i)
+    update (0);
+  BOOST_CHECK (applied.empty ());
+}
+
+BOOST_FIXTURE_TEST_CASE (at_most_once_an_interval, fixture)
+{
+  update (100 * GST_MSECOND);
+  for (int i = 0; i != 10; ++i)
+    j->add (200 * GST_MSECOND, controller.wait);
+  controller.update (now + controller.interval / 2, [this] (GstClockTime wait) { applied.push_back (wait); });
+  BOOST_CHECK_EQUAL (applied.size (), 1u);
+}
+
+BOOST_FIXTURE_TEST_CASE (removed_jitter_not_measured, fixture)
+{
+  auto other = std::make_shared<jitter> (10);
+  controller.add (other);
+  for (int i = 0; i != 10; ++i)
+    other->add (300 * GST_MSECOND, controller.wait);
+  controller.remove (other);
+  update (0);
+  BOOST_CHECK (applied.empty ());
+}
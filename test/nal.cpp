@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright 2018 Felipe Magno de Almeida.
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+
+#define BOOST_TEST_MODULE nal
+#include <boost/test/included/unit_test.hpp>
+
+#include <rtvc/video/nal.hpp>
+
+#include <vector>
+
+using rtvc::video::codec;
+using rtvc::video::non_reference;
+
+namespace {
+
+// One NAL unit behind a four byte start code
+std::vector<std::uint8_t> unit (std::vector<std::uint8_t> header)
+{
+  std::vector<std::uint8_t> data {0, 0, 0, 1};
+  data.insert (data.end (), header.begin (), header.end ());
+  data.insert (data.end (), {0x88, 0x84, 0x00});
+  return data;
+}
+
+std::vector<std::uint8_t> operator+ (std::vector<std::uint8_t> a, std::vector<std::uint8_t> const& b)
+{
+  a.insert (a.end (), b.begin (), b.end ());
+  return a;
+}
+
+bool check (codec c, std::vector<std::uint8_t> const& data)
+{
+  return non_reference (c, data.data (), data.size ());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE (h264)
+{
+  // Non-reference slice, nal_ref_idc 0
+  BOOST_CHECK (check (codec::h264, unit ({0x01})));
+  // Reference slice and IDR
+  BOOST_CHECK (!check (codec::h264, unit ({0x41})));
+  BOOST_CHECK (!check (codec::h264, unit ({0x65})));
+  // Parameter sets and SEI before the slice are skipped
+  BOOST_CHECK (check (codec::h264, unit ({0x67}) + unit ({0x68}) + unit ({0x06}) + unit ({0x01})));
+  BOOST_CHECK (!check (codec::h264, unit ({0x09}) + unit ({0x65})));
+  // No slice at all
+  BOOST_CHECK (!check (codec::h264, unit ({0x67}) + unit ({0x68})));
+}
+
+BOOST_AUTO_TEST_CASE (h265)
+{
+  // TRAIL_N and RASL_N
+  BOOST_CHECK (check (codec::h265, unit ({0x00, 0x01})));
+  BOOST_CHECK (check (codec::h265, unit ({0x10, 0x01})));
+  // TRAIL_R, IDR_W_RADL and CRA
+  BOOST_CHECK (!check (codec::h265, unit ({0x02, 0x01})));
+  BOOST_CHECK (!check (codec::h265, unit ({0x26, 0x01})));
+  BOOST_CHECK (!check (codec::h265, unit ({0x2a, 0x01})));
+  // VPS, SPS, PPS and AUD before the slice are skipped
+  BOOST_CHECK (check (codec::h265, unit ({0x40, 0x01}) + unit ({0x42, 0x01}) + unit ({0x44, 0x01})
+                      + unit ({0x46, 0x01}) + unit ({0x00, 0x01})));
+}
+
+BOOST_AUTO_TEST_CASE (other)
+{
+  BOOST_CHECK (!check (codec::other, unit ({0x01})));
+  // Too short for a header
+  std::vector<std::uint8_t> start {0, 0, 1};
+  BOOST_CHECK (!check (codec::h264, start));
+  BOOST_CHECK (!non_reference (codec::h264, nullptr, 0));
+}
+
+BOOST_AUTO_TEST_CASE (codec_from_caps)
+{
+  gst_init (nullptr, nullptr);
+  struct { char const* caps; codec expected; } cases[] =
+    {
+      {"video/x-h264, stream-format=byte-stream", codec::h264}
+      , {"video/x-h264", codec::h264}
+      , {"video/x-h264, stream-format=avc", codec::other}
+      , {"video/x-h265, stream-format=byte-stream", codec::h265}
+      , {"video/x-h265, stream-format=hvc1", codec::other}
+      , {"image/jpeg", codec::other}
+    };
+  for (auto&& c : cases)
+  {
+    GstCaps* caps = gst_caps_from_string (c.caps);
+    BOOST_CHECK_MESSAGE (rtvc::video::codec_from_caps (caps) == c.expected, c.caps);
+    gst_caps_unref (caps);
+  }
+  BOOST_CHECK (rtvc::video::codec_from_caps (nullptr) == codec::other);
+}